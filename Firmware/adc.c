@@ -1,10 +1,17 @@
 #include "adc.h"
 
 #include "board.h"
+#include "boot.h"
+#include "capture.h"
 #include "data.h"
 #include "mux.h"
 #include "nrfx_saadc.h"
+#include "power.h"
+#include "protection.h"
+#include "schedule.h"
 #include "sdk_config.h"
+#include "stream.h"
+#include "trace.h"
 
 #define NRF_LOG_MODULE_NAME adc
 #include "log.h"
@@ -26,38 +33,51 @@ NRF_LOG_MODULE_REGISTER();
     .channel_index = _index,                                               \
   }
 
+#define SAADC_CHANNEL_ENTRY(_pin_p, _index) SAADC_CHANNEL_CONF(_pin_p, _index),
+
 static const nrfx_saadc_channel_t channels_config[] = {
-    SAADC_CHANNEL_CONF(LOWER_MUX_ADC, 0),
-    SAADC_CHANNEL_CONF(UPPER_MUX_ADC, 1),
-};
+    BOARD_ADC_CHANNELS(SAADC_CHANNEL_ENTRY)};
 #define ADC_CHANNEL_COUNT      NRFX_ARRAY_SIZE(channels_config)
 
+STATIC_ASSERT(ADC_CHANNEL_COUNT == BOARD_ADC_CHANNEL_COUNT,
+              "BOARD_ADC_CHANNELS does not match BOARD_ADC_CHANNEL_COUNT");
+STATIC_ASSERT(ADC_SLOT_COUNT <= 32, "slot masks are 32 bit");
+
 #define ADC_SAMPLE_START_TICKS 5
 #define ADC_CLEAR_TIMER_TICKS  25
 
-#define ADC_NUMBER_OF_SAMPLES  128  // 8x 16 Signals
-
 static nrf_saadc_value_t samples_buffer[ADC_NUMBER_OF_SAMPLES];
 
+static void adc_start_block(void);
+
 static void saadc_handler(nrfx_saadc_evt_t const *p_event) {
   switch (p_event->type) {
     case NRFX_SAADC_EVT_DONE:  // result of EVT_END, current buffer is filled
       // NRF_LOG_DEBUG("SAADC-DONE event");
       // NRF_SAADC_STATE_ADV_MODE_SAMPLE_STARTED
+      trace_record(TRACE_SAADC_BEGIN, 0);
+      stream_process_buffer(p_event->data.done.p_buffer);
+      capture_process_buffer(p_event->data.done.p_buffer);
       data_process_buffer(p_event->data.done.p_buffer);
 
-      // reinitialize adc to prevent sample swaps by clearing excess samples
+      // reinitialize adc to prevent sample swaps by clearing excess samples,
+      // the next block starts right away or after the monitor interval
       nrfx_saadc_uninit();
-      adc_init();
-
-      // restart adc when data processing is finished
-      mux_pwm_adc_start();
+      power_block_done();
+      schedule_block_done();  // after the next block is set up
+      trace_record(TRACE_SAADC_END, 0);
       break;
     case NRFX_SAADC_EVT_LIMIT:
-      NRF_LOG_DEBUG("SAADC-LIMIT event");
+      if (p_event->data.limit.limit_type == NRF_SAADC_LIMIT_HIGH) {
+        trace_record(TRACE_SAADC_LIMIT, p_event->data.limit.channel);
+        protection_limit_event(p_event->data.limit.channel);
+      }
       break;
-    case NRFX_SAADC_EVT_CALIBRATEDONE:
+    case NRFX_SAADC_EVT_CALIBRATEDONE:  // only at boot, see adc_init()
       NRF_LOG_DEBUG("SAADC-CALIBRATEDONE event");
+      adc_start_block();
+      mux_pwm_adc_start();
+      boot_stage(BOOT_STAGE_SAMPLING);
       break;
     case NRFX_SAADC_EVT_BUF_REQ:  // result of EVT_STARTED
       // NRF_LOG_DEBUG("SAADC-BUF_REQ event");
@@ -74,7 +94,7 @@ static void saadc_handler(nrfx_saadc_evt_t const *p_event) {
   }
 }
 
-void adc_init(void) {
+static void adc_configure(void) {
   nrfx_err_t status;
 
   status = nrfx_saadc_init(NRFX_SAADC_CONFIG_IRQ_PRIORITY);
@@ -82,9 +102,10 @@ void adc_init(void) {
 
   status = nrfx_saadc_channels_config(channels_config, ADC_CHANNEL_COUNT);
   ERROR_CHECK("SAADC config", status);
+}
 
-  status = nrfx_saadc_offset_calibrate(NULL);     // NULL -> blocking
-  ERROR_CHECK("SAADC offset calibrate", status);  // NRF_SAADC_STATE_IDLE
+static void adc_start_block(void) {
+  nrfx_err_t status;
 
   nrfx_saadc_adv_config_t adv_config = {
       .oversampling = NRF_SAADC_OVERSAMPLE_DISABLED,
@@ -93,10 +114,12 @@ void adc_init(void) {
       .start_on_end = false};
 
   status = nrfx_saadc_advanced_mode_set(
-      0b00000011, ADC_RESOLUTON, &adv_config, saadc_handler);
+      (1 << ADC_CHANNEL_COUNT) - 1, ADC_RESOLUTON, &adv_config, saadc_handler);
   ERROR_CHECK("SAADC mode set", status);
   // NRF_SAADC_STATE_ADV_MODE, both buffers set to NULL
 
+  protection_limits_apply();
+
   status = nrfx_saadc_buffer_set(samples_buffer, ADC_NUMBER_OF_SAMPLES);
   ERROR_CHECK("SAADC samples buffer set", status);
 
@@ -105,3 +128,22 @@ void adc_init(void) {
   // NRF_SAADC_STATE_ADV_MODE_SAMPLE ->
   // NRF_SAADC_STATE_ADV_MODE_SAMPLE_STARTED
 }
+
+// sets up the next block after nrfx_saadc_uninit(), the mux is started after
+void adc_restart(void) {
+  adc_configure();
+
+  nrfx_err_t status = nrfx_saadc_offset_calibrate(NULL);  // NULL -> blocking
+  ERROR_CHECK("SAADC offset calibrate", status);  // NRF_SAADC_STATE_IDLE
+
+  adc_start_block();
+}
+
+// the offset calibration runs in the background while the boot continues,
+// its event starts the first block together with the mux
+void adc_init(void) {
+  adc_configure();
+
+  nrfx_err_t status = nrfx_saadc_offset_calibrate(saadc_handler);
+  ERROR_CHECK("SAADC offset calibrate", status);
+}
@@ -1,9 +1,26 @@
 #ifndef ADC_H
 #define ADC_H
 
+#include <stdint.h>
+
+#include "board.h"
+
 // max 12bit otherwise danger of type overflow!
-#define ADC_RESOLUTON NRF_SAADC_RESOLUTION_12BIT
+#define ADC_RESOLUTON      NRF_SAADC_RESOLUTION_12BIT
+#define ADC_RESOLUTON_BITS (8 + (2 * ADC_RESOLUTON))  // nrf enum magic numbers
+#define ADC_RANGE          (1 << ADC_RESOLUTON_BITS)
+
+// every buffer holds 8 rows of all mux slots
+#define ADC_SLOT_COUNT        (BOARD_MUX_STEP_COUNT * BOARD_ADC_CHANNEL_COUNT)
+#define ADC_ROW_COUNT         8
+#define ADC_NUMBER_OF_SAMPLES (ADC_ROW_COUNT * ADC_SLOT_COUNT)
+
+// one bit per slot, sent as ADC_SLOT_MASK_BYTES little endian bytes
+typedef uint32_t adc_slot_mask_t;
+#define ADC_SLOT_MASK_BYTES ((ADC_SLOT_COUNT + 7) / 8)
+#define ADC_SLOT_MASK_ALL   ((adc_slot_mask_t)((1ULL << ADC_SLOT_COUNT) - 1))
 
 void adc_init(void);
+void adc_restart(void);
 
 #endif  // ADC_H
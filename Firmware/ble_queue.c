@@ -0,0 +1,165 @@
+#include "ble_queue.h"
+
+#include "ble_services.h"
+#include "bluetooth.h"
+
+#define NRF_LOG_MODULE_NAME ble_queue
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// number of entries per queue and link, must be a power of two
+#define BLE_QUEUE_LIVE_SIZE 8
+#define BLE_QUEUE_BULK_SIZE 16
+
+// every link has its own rings, so a slow link or a stream subscriber only
+// fills its own entries and never makes another link drop
+typedef struct {
+  uint16_t handle;
+  uint16_t length;
+  uint8_t data[BLE_NOTIFY_MAX_LENGTH];
+} ble_queue_entry_t;
+
+typedef struct {
+  uint8_t head;  // oldest entry not yet sent
+  uint8_t tail;  // next free entry
+} ble_queue_ring_t;
+
+static ble_queue_entry_t live_entries[BLE_LINK_COUNT][BLE_QUEUE_LIVE_SIZE];
+static ble_queue_entry_t bulk_entries[BLE_LINK_COUNT][BLE_QUEUE_BULK_SIZE];
+
+// producers (SAADC, GPIOTE, app timer and BLE events) all run at
+// APP_IRQ_PRIORITY_LOW, so they never preempt each other
+static ble_queue_ring_t rings[BLE_QUEUE_COUNT][BLE_LINK_COUNT];
+static const uint8_t ring_sizes[BLE_QUEUE_COUNT] = {
+    [BLE_QUEUE_LIVE] = BLE_QUEUE_LIVE_SIZE,
+    [BLE_QUEUE_BULK] = BLE_QUEUE_BULK_SIZE,
+};
+
+static ble_queue_stats_t stats = {0};
+
+static uint8_t ble_queue_fill(ble_queue_t queue, uint8_t link) {
+  ble_queue_ring_t const *p_ring = &rings[queue][link];
+  return (uint8_t)(p_ring->tail - p_ring->head);
+}
+
+bool ble_queue_has_space(ble_queue_t queue, uint8_t link) {
+  return ble_queue_fill(queue, link) < ring_sizes[queue];
+}
+
+static ble_queue_entry_t *ble_queue_entry(ble_queue_t queue,
+                                          uint8_t link,
+                                          uint8_t position) {
+  uint8_t index = position & (ring_sizes[queue] - 1);
+  if (queue == BLE_QUEUE_LIVE) {
+    return &live_entries[link][index];
+  }
+  return &bulk_entries[link][index];
+}
+
+bool ble_queue_is_empty(ble_queue_t queue, uint8_t link) {
+  return ble_queue_fill(queue, link) == 0;
+}
+
+// copied into the ring of every link, a full ring only drops for its link,
+// returns false if any link dropped it
+bool ble_queue_push(ble_queue_t queue,
+                    uint8_t links,
+                    uint16_t handle,
+                    uint8_t const *p_data,
+                    uint16_t length) {
+  bool is_queued = true;
+
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (!(links & BLE_LINK(link))) {
+      continue;
+    }
+    if (!ble_queue_has_space(queue, link) ||
+        (BLE_NOTIFY_MAX_LENGTH < length)) {
+      stats.dropped++;
+      is_queued = false;
+      continue;
+    }
+
+    ble_queue_ring_t *p_ring = &rings[queue][link];
+    ble_queue_entry_t *p_entry = ble_queue_entry(queue, link, p_ring->tail);
+    p_entry->handle = handle;
+    p_entry->length = length;
+    memcpy(p_entry->data, p_data, length);
+    p_ring->tail++;
+  }
+  return is_queued;
+}
+
+// sends the entries of one ring in order, returns false once the
+// softdevice queue of that link is full
+static bool ble_queue_flush_link(ble_queue_t queue,
+                                 uint8_t link,
+                                 uint16_t connection_handle) {
+  ble_queue_ring_t *p_ring = &rings[queue][link];
+  uint16_t max_length = ble_get_notify_length(BLE_LINK(link));
+
+  for (; p_ring->head != p_ring->tail; p_ring->head++) {
+    ble_queue_entry_t *p_entry = ble_queue_entry(queue, link, p_ring->head);
+    // producers size to the MTU, records that never fit it are dropped
+    if (max_length < p_entry->length) {
+      stats.dropped++;
+      continue;
+    }
+
+    uint16_t len = p_entry->length;
+    ble_gatts_hvx_params_t hvx_params = {
+        .handle = p_entry->handle,
+        .type = BLE_GATT_HVX_NOTIFICATION,
+        .offset = 0,
+        .p_len = &len,
+        .p_data = p_entry->data,
+    };
+
+    uint32_t err_code = sd_ble_gatts_hvx(connection_handle, &hvx_params);
+    if (err_code == NRF_ERROR_RESOURCES) {
+      // resumed on BLE_GATTS_EVT_HVN_TX_COMPLETE
+      stats.retries++;
+      return false;
+    }
+    ERROR_CHECK("queued notify", err_code);
+    if (err_code == NRF_SUCCESS) {
+      stats.sent++;
+      stats.bytes += len;
+    } else {
+      stats.dropped++;
+    }
+  }
+  return true;
+}
+
+// hands queued notifications to the softdevice until its queue is full,
+// live values always go first
+void ble_queue_flush(void) {
+  ble_os_t const *p_service = ble_get_service();
+  uint8_t blocked = 0;
+
+  for (size_t i = 0; i < BLE_QUEUE_COUNT; i++) {
+    for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+      uint16_t connection_handle = p_service->connection_handles[link];
+      if ((connection_handle == BLE_CONN_HANDLE_INVALID) ||
+          (blocked & BLE_LINK(link))) {
+        continue;
+      }
+      if (!ble_queue_flush_link(i, link, connection_handle)) {
+        blocked |= BLE_LINK(link);
+      }
+    }
+  }
+}
+
+void ble_queue_clear(uint8_t link) {
+  for (size_t i = 0; i < BLE_QUEUE_COUNT; i++) {
+    rings[i][link].head = rings[i][link].tail;
+  }
+  NRF_LOG_INFO("notifications sent: %u, dropped: %u, retries: %u",
+               stats.sent,
+               stats.dropped,
+               stats.retries);
+}
+
+ble_queue_stats_t const *ble_queue_get_stats(void) { return &stats; }
@@ -0,0 +1,27 @@
+#ifndef BLE_QUEUE_H
+#define BLE_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum { BLE_QUEUE_LIVE, BLE_QUEUE_BULK, BLE_QUEUE_COUNT } ble_queue_t;
+
+typedef struct {
+  uint32_t sent;
+  uint32_t bytes;
+  uint32_t dropped;  // queue of a link full, notification discarded
+  uint32_t retries;  // softdevice queue full, notification kept for later
+} ble_queue_stats_t;
+
+bool ble_queue_push(ble_queue_t queue,
+                    uint8_t links,
+                    uint16_t handle,
+                    uint8_t const *p_data,
+                    uint16_t length);
+bool ble_queue_has_space(ble_queue_t queue, uint8_t link);
+bool ble_queue_is_empty(ble_queue_t queue, uint8_t link);
+void ble_queue_flush(void);
+void ble_queue_clear(uint8_t link);
+ble_queue_stats_t const *ble_queue_get_stats(void);
+
+#endif  // BLE_QUEUE_H
@@ -1,8 +1,12 @@
 #include "ble_services.h"
 
+#include "ble_queue.h"
 #include "ble_srv_common.h"
 #include "bluetooth.h"
+#include "chain.h"
+#include "config.h"
 #include "nrf_ble_gatt.h"
+#include "power.h"
 
 #define NRF_LOG_MODULE_NAME ble_serv
 #include "log.h"
@@ -20,291 +24,388 @@ NRF_LOG_MODULE_REGISTER();
 #define BLE_DEVIATION_CHAR_UUID   0xAB02
 #define BLE_HISTORY_1H_CHAR_UUID  0xAB03
 #define BLE_HISTORY_12H_CHAR_UUID 0xAB04
-#define BLE_PWM_SET_CHAR_UUID     0xAB05
+#define BLE_COMMAND_CHAR_UUID     0xAB05
+#define BLE_TIME_CHAR_UUID        0xAB06
+#define BLE_HISTORY_LAYOUT_UUID   0xAB07
+#define BLE_BATCH_CHAR_UUID       0xAB08
+#define BLE_CHANGE_CHAR_UUID      0xAB09
+#define BLE_STREAM_CHAR_UUID      0xAB0A
+#define BLE_CAPTURE_CHAR_UUID     0xAB0B
+#define BLE_PACK_CHAR_UUID        0xAB0C
+#define BLE_TRACE_CHAR_UUID       0xAB0D
+#define BLE_CONFIG_CHAR_UUID      0xAB0E
+#define BLE_SUMMARY_CHAR_UUID     0xAB0F
+
+// timestamp + 2 bytes * (8 voltages + 8 currents)
+#define BLE_VALUE_CHAR_LENGTH     sizeof(data_record_t)
+// longer writes than COMMAND_MAX_LENGTH are answered with INVALID_LENGTH,
+// responses fill a notification
+#define BLE_COMMAND_CHAR_LENGTH   BLE_NOTIFY_MAX_LENGTH
+// unix time in milliseconds
+#define BLE_TIME_CHAR_LENGTH      sizeof(uint64_t)
+
+// any cell voltage or current moving this far sends the batch right away
+#define BLE_BATCH_FLUSH_DELTA     20
+
+// reporting periods without change before everything is sent again
+#define BLE_CHANGE_HEARTBEAT      60
+
+// cached cccd state per link, written by the client and reset on (dis)connect
+static bool notification_enabled[BLE_LINK_COUNT][CHAR_TYPE_COUNT] = {false};
+
+void ble_set_notification_enabled(uint8_t link, uint8_t type, bool is_enabled) {
+  notification_enabled[link][type] = is_enabled;
+  if (is_enabled) {
+    power_wake();  // live subscribers get full rate right away
+  }
+}
+
+void ble_reset_notification_enabled(uint8_t link) {
+  memset(notification_enabled[link], 0, sizeof(notification_enabled[link]));
+}
 
-// 2 bytes * (8 voltages + 8 currents)
-#define BLE_VALUE_CHAR_LENGTH     (sizeof(uint16_t) * (8 + 8))
-// (8 values * 3 characters) + 7 commas
-#define BLE_PWM_CHAR_LENGTH       ((8 * 3) + 7)
+bool is_notification_enabled(uint8_t link, uint8_t type) {
+  return notification_enabled[link][type];
+}
 
-bool is_notification_enabled(uint8_t type) {
-  uint8_t cccd_value[BLE_CCCD_VALUE_LEN];
+uint8_t ble_get_subscribers(uint8_t type) {
+  uint8_t links = 0;
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (notification_enabled[link][type]) {
+      links |= BLE_LINK(link);
+    }
+  }
+  return links;
+}
+
+// records that fit into one notification on every link, at least one
+uint8_t ble_get_history_records(uint8_t links) {
+  uint8_t count = ble_get_notify_length(links) / sizeof(history_record_t);
+  return MIN(BLE_HISTORY_RECORDS, MAX(count, 1));
+}
+
+void ble_notify_history_values(uint8_t links,
+                               history_record_t records[],
+                               uint8_t count,
+                               uint8_t type) {
   ble_os_t *p_service = ble_get_service();
-  uint16_t cccd_handle = 0;
-  ble_gatts_value_t gatts_val = {
-      .len = BLE_CCCD_VALUE_LEN, .offset = 0, .p_value = cccd_value};
 
+  links &= ble_get_subscribers(type);
+  if (links == 0) {
+    return;
+  }
+  count = MIN(count, ble_get_history_records(links));
+
+  uint16_t handle = BLE_GATT_HANDLE_INVALID;
   switch (type) {
-    case VALUES:
-      cccd_handle = p_service->values_handles.cccd_handle;
-      break;
-    case DEVIATIONS:
-      cccd_handle = p_service->deviation_handles.cccd_handle;
-      break;
     case HISTORY_1H:
-      cccd_handle = p_service->history_1h_handles.cccd_handle;
+      handle = p_service->history_1h_handles.value_handle;
       break;
     case HISTORY_12H:
-      cccd_handle = p_service->history_12h_handles.cccd_handle;
-      break;
-    default:
-      NRF_LOG_ERROR("undefined type")
+      handle = p_service->history_12h_handles.value_handle;
       break;
   }
 
-  uint32_t err_code = sd_ble_gatts_value_get(
-      p_service->connection_handle, cccd_handle, &gatts_val);
-  ERROR_CHECK("gatts value get", err_code);
+  ble_queue_push(BLE_QUEUE_BULK,
+                 links,
+                 handle,
+                 (uint8_t *)records,
+                 count * sizeof(history_record_t));
+  ble_queue_flush();
+}
+
+typedef struct {
+  ble_batch_record_t records[BLE_BATCH_MAX_RECORDS];
+  uint8_t count;
+  uint8_t size;  // records per notification, see ble_set_batch_size
+  // values of the last record sent, the reference for a step change
+  uint16_t flushed[2 * NUMBER_OF_CELLS];
+  bool is_flushed_valid;
+} ble_batch_t;
+
+static ble_batch_t batch = {.count = 0, .size = BLE_BATCH_MAX_RECORDS};
 
-  return ble_srv_is_notification_enabled(cccd_value);
+bool ble_set_batch_size(uint8_t size) {
+  if ((size < 1) || (BLE_BATCH_MAX_RECORDS < size)) {
+    return false;
+  }
+  batch.size = size;
+  NRF_LOG_INFO("batch size %i", size);
+  return true;
+}
+
+static bool ble_batch_is_significant(data_record_t const *p_values) {
+  if (!batch.is_flushed_valid) {
+    return false;
+  }
+
+  for (size_t i = 0; i < 2 * NUMBER_OF_CELLS; i++) {
+    int32_t delta = (int32_t)p_values->values[i] - batch.flushed[i];
+    if ((delta < -BLE_BATCH_FLUSH_DELTA) || (BLE_BATCH_FLUSH_DELTA < delta)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void ble_notify_history_values(uint16_t values[], uint8_t type) {
+// collects reporting periods and sends them in a single notification
+void ble_notify_batch(data_record_t const *p_values,
+                      data_record_t const *p_deviations) {
   ble_os_t *p_service = ble_get_service();
 
-  if (p_service->connection_handle == BLE_CONN_HANDLE_INVALID) {
+  uint8_t links = ble_get_subscribers(BATCH);
+  if (links == 0) {
+    batch.count = 0;
+    batch.is_flushed_valid = false;
     return;
   }
 
-  if (!is_notification_enabled(type)) {
+  bool is_significant = ble_batch_is_significant(p_values);
+
+  ble_batch_record_t *p_record = &batch.records[batch.count++];
+  p_record->timestamp = p_values->timestamp;
+  memcpy(p_record->values, p_values->values, sizeof(p_record->values));
+  memcpy(p_record->deviations,
+         p_deviations->values,
+         sizeof(p_record->deviations));
+
+  // a smaller MTU on any subscribed link sends fewer records at once
+  uint8_t fit = ble_get_notify_length(links) / sizeof(ble_batch_record_t);
+  if (!is_significant && (batch.count < MIN(batch.size, MAX(fit, 1)))) {
     return;
   }
 
-  uint16_t len = BLE_HISTORY_CHAR_LENGTH;
-  ble_gatts_hvx_params_t hvx_params;
+  ble_queue_push(BLE_QUEUE_LIVE,
+                 links,
+                 p_service->batch_handles.value_handle,
+                 (uint8_t *)batch.records,
+                 batch.count * sizeof(ble_batch_record_t));
+  ble_queue_flush();
+  memcpy(batch.flushed, p_record->values, sizeof(batch.flushed));
+  batch.is_flushed_valid = true;
+  batch.count = 0;
+}
 
-  memset(&hvx_params, 0, sizeof(hvx_params));
-  switch (type) {
-    case HISTORY_1H:
-      hvx_params.handle = p_service->history_1h_handles.value_handle;
-      break;
-    case HISTORY_12H:
-      hvx_params.handle = p_service->history_12h_handles.value_handle;
-      break;
+typedef struct {
+  uint16_t reported[4 * NUMBER_OF_CELLS];  // last value sent per index
+  uint16_t deadbands[BLE_DEADBAND_COUNT];
+  uint16_t heartbeat;
+  uint16_t silence;     // reporting periods since the last notification
+  uint8_t subscribers;  // new subscribers get a full report
+} ble_changes_t;
+
+static ble_changes_t changes = {
+    .deadbands = {[0 ... BLE_DEADBAND_COUNT - 1] = 5},
+    .heartbeat = BLE_CHANGE_HEARTBEAT,
+};
+
+bool ble_set_deadband(uint8_t lane, uint16_t deadband) {
+  if (BLE_DEADBAND_COUNT <= lane) {
+    return false;
+  }
+  changes.deadbands[lane] = deadband;
+  NRF_LOG_INFO("deadband %i: %i", lane, deadband);
+  return true;
+}
+
+bool ble_set_heartbeat(uint16_t periods) {
+  if (periods == 0) {
+    return false;
   }
-  hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
-  hvx_params.offset = 0;
-  hvx_params.p_len = &len;
-  hvx_params.p_data = (uint8_t *)values;
+  changes.heartbeat = periods;
+  NRF_LOG_INFO("heartbeat %i", periods);
+  return true;
+}
 
-  uint32_t err_code =
-      sd_ble_gatts_hvx(p_service->connection_handle, &hvx_params);
-  ERROR_CHECK("history char notify", err_code);
+// values are interleaved voltage, current and followed by the deviations
+static uint8_t ble_change_lane(size_t index) {
+  uint8_t lane = (index & 1) ? BLE_DEADBAND_CURRENT : BLE_DEADBAND_VOLTAGE;
+  if (2 * NUMBER_OF_CELLS <= index) {
+    lane += BLE_DEADBAND_VOLTAGE_DEVIATION;
+  }
+  return lane;
 }
 
-void ble_notify_cell_values(uint16_t values[], uint8_t type) {
+// notifies only values that moved further than their deadband
+void ble_notify_changes(data_record_t const *p_values,
+                        data_record_t const *p_deviations) {
+  static ble_change_record_t record;  // kept off the stack, queue copies it
   ble_os_t *p_service = ble_get_service();
 
-  if (p_service->connection_handle == BLE_CONN_HANDLE_INVALID) {
+  uint8_t links = ble_get_subscribers(CHANGES);
+  bool is_full = (links & ~changes.subscribers) ||
+                 (changes.heartbeat <= ++changes.silence);
+  if (links == 0) {
+    changes.subscribers = 0;
     return;
   }
 
-  if (!is_notification_enabled(type)) {
+  // a smaller MTU on any subscribed link splits the report
+  size_t header = offsetof(ble_change_record_t, values);
+  size_t length = MAX(ble_get_notify_length(links),
+                      header + sizeof(record.values[0]));
+  uint8_t max_count = MIN(ARRAY_SIZE(record.values),
+                          (length - header) / sizeof(record.values[0]));
+
+  uint16_t latest[4 * NUMBER_OF_CELLS];
+  bool is_sent = false;
+  bool is_dropped = false;
+  size_t i = 0;
+  while (i < 4 * NUMBER_OF_CELLS) {
+    size_t first = i;
+    record.timestamp = p_values->timestamp;
+    memset(record.changed, 0, sizeof(record.changed));
+    uint8_t count = 0;
+    for (; (i < 4 * NUMBER_OF_CELLS) && (count < max_count); i++) {
+      latest[i] = (i < 2 * NUMBER_OF_CELLS)
+                      ? p_values->values[i]
+                      : p_deviations->values[i - 2 * NUMBER_OF_CELLS];
+      int32_t delta = (int32_t)latest[i] - changes.reported[i];
+      uint16_t deadband = changes.deadbands[ble_change_lane(i)];
+      if (is_full || (delta < -deadband) || (deadband < delta)) {
+        record.changed[i / 8] |= 1 << (i % 8);
+        record.values[count++] = latest[i];
+      }
+    }
+
+    if (count == 0) {
+      continue;
+    }
+
+    // a dropped part leaves its values as is, the change goes out next time
+    if (!ble_queue_push(BLE_QUEUE_LIVE,
+                        links,
+                        p_service->change_handles.value_handle,
+                        (uint8_t *)&record,
+                        header + count * sizeof(record.values[0]))) {
+      is_dropped = true;
+      break;
+    }
+    for (size_t j = first; j < i; j++) {
+      if (record.changed[j / 8] & (1 << (j % 8))) {
+        changes.reported[j] = latest[j];
+      }
+    }
+    is_sent = true;
+  }
+
+  if (!is_sent) {
     return;
   }
+  // an incomplete full report is repeated on the next period
+  if (!is_dropped) {
+    changes.subscribers = links;
+    changes.silence = 0;
+  }
+  ble_queue_flush();
+}
 
-  uint16_t len = BLE_VALUE_CHAR_LENGTH;
-  ble_gatts_hvx_params_t hvx_params;
+// queued once, the queue fans it out to every subscribed link
+void ble_notify_cell_values(data_record_t const *p_record, uint8_t type) {
+  ble_os_t *p_service = ble_get_service();
 
-  memset(&hvx_params, 0, sizeof(hvx_params));
+  uint8_t links = ble_get_subscribers(type);
+  if (links == 0) {
+    return;
+  }
+
+  uint16_t handle = BLE_GATT_HANDLE_INVALID;
   switch (type) {
     case VALUES:
-      hvx_params.handle = p_service->values_handles.value_handle;
+      handle = p_service->values_handles.value_handle;
       break;
     case DEVIATIONS:
-      hvx_params.handle = p_service->deviation_handles.value_handle;
+      handle = p_service->deviation_handles.value_handle;
       break;
   }
-  hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
-  hvx_params.offset = 0;
-  hvx_params.p_len = &len;
-  hvx_params.p_data = (uint8_t *)values;
 
-  uint32_t err_code =
-      sd_ble_gatts_hvx(p_service->connection_handle, &hvx_params);
-  ERROR_CHECK("value char notify", err_code);
+  ble_queue_push(BLE_QUEUE_LIVE,
+                 links,
+                 handle,
+                 (uint8_t *)p_record,
+                 BLE_VALUE_CHAR_LENGTH);
+  ble_queue_flush();
 }
 
-// could be refactored into a single function
-static void ble_values_char_add(ble_os_t *p_service) {
-  uint32_t err_code;
-  ble_uuid_t char_uuid;
-  ble_uuid128_t base_uuid = BLE_BASE_UUID;
-  char_uuid.uuid = BLE_VALUE_CHAR_UUID;
-  err_code = sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-  ERROR_CHECK("value char uuid add", err_code);
-
-  ble_gatts_attr_md_t client_ccd_metadata;
-  memset(&client_ccd_metadata, 0, sizeof(client_ccd_metadata));
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.write_perm);
-  client_ccd_metadata.vloc = BLE_GATTS_VLOC_STACK;
-
-  ble_gatts_char_md_t char_metadata;
-  memset(&char_metadata, 0, sizeof(char_metadata));
-  char_metadata.char_props.read = 1;
-  char_metadata.char_props.write = 0;
-  char_metadata.p_cccd_md = &client_ccd_metadata;
-  char_metadata.char_props.notify = 1;
-
-  ble_gatts_attr_md_t attr_metadata;
-  memset(&attr_metadata, 0, sizeof(attr_metadata));
-  attr_metadata.vloc = BLE_GATTS_VLOC_STACK;
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.write_perm);
+void ble_notify_command_response(uint8_t link,
+                                 uint8_t const *p_data,
+                                 uint16_t length) {
+  ble_os_t *p_service = ble_get_service();
 
-  ble_gatts_attr_t attr_char_value;
-  memset(&attr_char_value, 0, sizeof(attr_char_value));
-  attr_char_value.p_uuid = &char_uuid;
-  attr_char_value.p_attr_md = &attr_metadata;
-  attr_char_value.max_len = BLE_VALUE_CHAR_LENGTH;
-  attr_char_value.init_len = BLE_VALUE_CHAR_LENGTH;
-  uint8_t value[BLE_VALUE_CHAR_LENGTH] = {};
-  attr_char_value.p_value = value;
+  if (!is_notification_enabled(link, COMMAND)) {
+    return;
+  }
 
-  err_code = sd_ble_gatts_characteristic_add(p_service->service_handle,
-                                             &char_metadata,
-                                             &attr_char_value,
-                                             &p_service->values_handles);
-  ERROR_CHECK("value char add", err_code);
+  ble_queue_push(BLE_QUEUE_LIVE,
+                 BLE_LINK(link),
+                 p_service->command_handles.value_handle,
+                 p_data,
+                 length);
+  ble_queue_flush();
 }
 
-static void ble_deviation_char_add(ble_os_t *p_service) {
-  uint32_t err_code;
-  ble_uuid_t char_uuid;
-  ble_uuid128_t base_uuid = BLE_BASE_UUID;
-  char_uuid.uuid = BLE_DEVIATION_CHAR_UUID;
-  err_code = sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-  ERROR_CHECK("deviation char uuid add", err_code);
-
-  ble_gatts_attr_md_t client_ccd_metadata;
-  memset(&client_ccd_metadata, 0, sizeof(client_ccd_metadata));
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.write_perm);
-  client_ccd_metadata.vloc = BLE_GATTS_VLOC_STACK;
-
-  ble_gatts_char_md_t char_metadata;
-  memset(&char_metadata, 0, sizeof(char_metadata));
-  char_metadata.char_props.read = 1;
-  char_metadata.char_props.write = 0;
-  char_metadata.p_cccd_md = &client_ccd_metadata;
-  char_metadata.char_props.notify = 1;
-
-  ble_gatts_attr_md_t attr_metadata;
-  memset(&attr_metadata, 0, sizeof(attr_metadata));
-  attr_metadata.vloc = BLE_GATTS_VLOC_STACK;
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.write_perm);
-
-  ble_gatts_attr_t attr_char_value;
-  memset(&attr_char_value, 0, sizeof(attr_char_value));
-  attr_char_value.p_uuid = &char_uuid;
-  attr_char_value.p_attr_md = &attr_metadata;
-  attr_char_value.max_len = BLE_VALUE_CHAR_LENGTH;
-  attr_char_value.init_len = BLE_VALUE_CHAR_LENGTH;
-  uint8_t value[BLE_VALUE_CHAR_LENGTH] = {};
-  attr_char_value.p_value = value;
+void ble_update_time_value(uint64_t unix_time) {
+  ble_os_t *p_service = ble_get_service();
+  ble_gatts_value_t gatts_val = {.len = BLE_TIME_CHAR_LENGTH,
+                                 .offset = 0,
+                                 .p_value = (uint8_t *)&unix_time};
 
-  err_code = sd_ble_gatts_characteristic_add(p_service->service_handle,
-                                             &char_metadata,
-                                             &attr_char_value,
-                                             &p_service->deviation_handles);
-  ERROR_CHECK("deviation char add", err_code);
+  uint32_t err_code =
+      sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID,
+                             p_service->time_handles.value_handle,
+                             &gatts_val);
+  ERROR_CHECK("time char value set", err_code);
 }
 
-static void ble_history_1h_char_add(ble_os_t *p_service) {
-  uint32_t err_code;
-  ble_uuid_t char_uuid;
-  ble_uuid128_t base_uuid = BLE_BASE_UUID;
-  char_uuid.uuid = BLE_HISTORY_1H_CHAR_UUID;
-  err_code = sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-  ERROR_CHECK("history 1h char uuid add", err_code);
-
-  ble_gatts_attr_md_t client_ccd_metadata;
-  memset(&client_ccd_metadata, 0, sizeof(client_ccd_metadata));
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.write_perm);
-  client_ccd_metadata.vloc = BLE_GATTS_VLOC_STACK;
-
-  ble_gatts_char_md_t char_metadata;
-  memset(&char_metadata, 0, sizeof(char_metadata));
-  char_metadata.char_props.read = 1;
-  char_metadata.char_props.write = 0;
-  char_metadata.p_cccd_md = &client_ccd_metadata;
-  char_metadata.char_props.notify = 1;
-
-  ble_gatts_attr_md_t attr_metadata;
-  memset(&attr_metadata, 0, sizeof(attr_metadata));
-  attr_metadata.vloc = BLE_GATTS_VLOC_STACK;
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.write_perm);
-
-  ble_gatts_attr_t attr_char_value;
-  memset(&attr_char_value, 0, sizeof(attr_char_value));
-  attr_char_value.p_uuid = &char_uuid;
-  attr_char_value.p_attr_md = &attr_metadata;
-  attr_char_value.max_len = BLE_HISTORY_CHAR_LENGTH;
-  attr_char_value.init_len = BLE_HISTORY_CHAR_LENGTH;
-  uint8_t value[BLE_HISTORY_CHAR_LENGTH] = {};
-  attr_char_value.p_value = value;
+void ble_update_config_value(void const *p_config) {
+  ble_os_t *p_service = ble_get_service();
+  ble_gatts_value_t gatts_val = {.len = sizeof(config_t),
+                                 .offset = 0,
+                                 .p_value = (uint8_t *)p_config};
 
-  err_code = sd_ble_gatts_characteristic_add(p_service->service_handle,
-                                             &char_metadata,
-                                             &attr_char_value,
-                                             &p_service->history_1h_handles);
-  ERROR_CHECK("history 1h char add", err_code);
+  uint32_t err_code =
+      sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID,
+                             p_service->config_handles.value_handle,
+                             &gatts_val);
+  ERROR_CHECK("config char value set", err_code);
 }
 
-static void ble_history_12h_char_add(ble_os_t *p_service) {
-  uint32_t err_code;
-  ble_uuid_t char_uuid;
-  ble_uuid128_t base_uuid = BLE_BASE_UUID;
-  char_uuid.uuid = BLE_HISTORY_12H_CHAR_UUID;
-  err_code = sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-  ERROR_CHECK("history 12h char uuid add", err_code);
-
-  ble_gatts_attr_md_t client_ccd_metadata;
-  memset(&client_ccd_metadata, 0, sizeof(client_ccd_metadata));
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&client_ccd_metadata.write_perm);
-  client_ccd_metadata.vloc = BLE_GATTS_VLOC_STACK;
-
-  ble_gatts_char_md_t char_metadata;
-  memset(&char_metadata, 0, sizeof(char_metadata));
-  char_metadata.char_props.read = 1;
-  char_metadata.char_props.write = 0;
-  char_metadata.p_cccd_md = &client_ccd_metadata;
-  char_metadata.char_props.notify = 1;
-
-  ble_gatts_attr_md_t attr_metadata;
-  memset(&attr_metadata, 0, sizeof(attr_metadata));
-  attr_metadata.vloc = BLE_GATTS_VLOC_STACK;
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.read_perm);
-  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.write_perm);
+// kept as the value for clients that only read now and then
+void ble_notify_summary(summary_record_t const *p_record) {
+  ble_os_t *p_service = ble_get_service();
+  ble_gatts_value_t gatts_val = {.len = sizeof(summary_record_t),
+                                 .offset = 0,
+                                 .p_value = (uint8_t *)p_record};
 
-  ble_gatts_attr_t attr_char_value;
-  memset(&attr_char_value, 0, sizeof(attr_char_value));
-  attr_char_value.p_uuid = &char_uuid;
-  attr_char_value.p_attr_md = &attr_metadata;
-  attr_char_value.max_len = BLE_HISTORY_CHAR_LENGTH;
-  attr_char_value.init_len = BLE_HISTORY_CHAR_LENGTH;
-  uint8_t value[BLE_HISTORY_CHAR_LENGTH] = {};
-  attr_char_value.p_value = value;
+  uint32_t err_code =
+      sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID,
+                             p_service->summary_handles.value_handle,
+                             &gatts_val);
+  ERROR_CHECK("summary char value set", err_code);
 
-  err_code = sd_ble_gatts_characteristic_add(p_service->service_handle,
-                                             &char_metadata,
-                                             &attr_char_value,
-                                             &p_service->history_12h_handles);
-  ERROR_CHECK("history 12h char add", err_code);
+  uint8_t links = ble_get_subscribers(SUMMARY);
+  if (links == 0) {
+    return;
+  }
+  ble_queue_push(BLE_QUEUE_LIVE,
+                 links,
+                 p_service->summary_handles.value_handle,
+                 (uint8_t const *)p_record,
+                 sizeof(summary_record_t));
+  ble_queue_flush();
 }
 
-static void ble_pwm_set_char_add(ble_os_t *p_service) {
+static void ble_char_add(ble_os_t *p_service,
+                         uint16_t uuid,
+                         uint16_t length,
+                         ble_gatt_char_props_t props,
+                         ble_gatts_char_handles_t *p_handles) {
   uint32_t err_code;
   ble_uuid_t char_uuid;
   ble_uuid128_t base_uuid = BLE_BASE_UUID;
-  char_uuid.uuid = BLE_PWM_SET_CHAR_UUID;
+  char_uuid.uuid = uuid;
   err_code = sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-  ERROR_CHECK("pwm set char uuid add", err_code);
+  ERROR_CHECK("char uuid add", err_code);
 
   ble_gatts_attr_md_t client_ccd_metadata;
   memset(&client_ccd_metadata, 0, sizeof(client_ccd_metadata));
@@ -314,14 +415,13 @@ static void ble_pwm_set_char_add(ble_os_t *p_service) {
 
   ble_gatts_char_md_t char_metadata;
   memset(&char_metadata, 0, sizeof(char_metadata));
-  char_metadata.char_props.read = 1;
-  char_metadata.char_props.write = 1;
-  char_metadata.p_cccd_md = &client_ccd_metadata;
-  char_metadata.char_props.notify = 1;  // unnecessary
+  char_metadata.char_props = props;
+  char_metadata.p_cccd_md = props.notify ? &client_ccd_metadata : NULL;
 
   ble_gatts_attr_md_t attr_metadata;
   memset(&attr_metadata, 0, sizeof(attr_metadata));
   attr_metadata.vloc = BLE_GATTS_VLOC_STACK;
+  attr_metadata.vlen = 1;  // commands and batches vary in length
   BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.read_perm);
   BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_metadata.write_perm);
 
@@ -329,16 +429,15 @@ static void ble_pwm_set_char_add(ble_os_t *p_service) {
   memset(&attr_char_value, 0, sizeof(attr_char_value));
   attr_char_value.p_uuid = &char_uuid;
   attr_char_value.p_attr_md = &attr_metadata;
-  attr_char_value.max_len = BLE_PWM_CHAR_LENGTH;
-  attr_char_value.init_len = BLE_PWM_CHAR_LENGTH;
-  uint8_t value[BLE_PWM_CHAR_LENGTH] = {};
+  attr_char_value.max_len = length;
+  attr_char_value.init_len = length;
+  uint8_t value[length];
+  memset(value, 0, length);
   attr_char_value.p_value = value;
 
-  err_code = sd_ble_gatts_characteristic_add(p_service->service_handle,
-                                             &char_metadata,
-                                             &attr_char_value,
-                                             &p_service->pwm_set_handles);
-  ERROR_CHECK("pwm_set char add", err_code);
+  err_code = sd_ble_gatts_characteristic_add(
+      p_service->service_handle, &char_metadata, &attr_char_value, p_handles);
+  ERROR_CHECK("char add", err_code);
 }
 
 void ble_service_init(ble_os_t *p_service) {
@@ -351,9 +450,95 @@ void ble_service_init(ble_os_t *p_service) {
   err_code = sd_ble_gatts_service_add(
       BLE_GATTS_SRVC_TYPE_PRIMARY, &service_uuid, &p_service->service_handle);
   ERROR_CHECK("balancer service add", err_code);
-  ble_values_char_add(p_service);
-  ble_deviation_char_add(p_service);
-  ble_history_1h_char_add(p_service);
-  ble_history_12h_char_add(p_service);
-  ble_pwm_set_char_add(p_service);
+
+  ble_gatt_char_props_t notify_props = {.read = 1, .notify = 1};
+  ble_gatt_char_props_t write_props = {.read = 1, .write = 1};
+  ble_gatt_char_props_t command_props = {.write = 1, .notify = 1};
+  ble_gatt_char_props_t read_props = {.read = 1};
+
+  ble_char_add(p_service,
+               BLE_VALUE_CHAR_UUID,
+               BLE_VALUE_CHAR_LENGTH,
+               notify_props,
+               &p_service->values_handles);
+  ble_char_add(p_service,
+               BLE_DEVIATION_CHAR_UUID,
+               BLE_VALUE_CHAR_LENGTH,
+               notify_props,
+               &p_service->deviation_handles);
+  ble_char_add(p_service,
+               BLE_HISTORY_1H_CHAR_UUID,
+               BLE_HISTORY_CHAR_LENGTH,
+               notify_props,
+               &p_service->history_1h_handles);
+  ble_char_add(p_service,
+               BLE_HISTORY_12H_CHAR_UUID,
+               BLE_HISTORY_CHAR_LENGTH,
+               notify_props,
+               &p_service->history_12h_handles);
+  ble_char_add(p_service,
+               BLE_COMMAND_CHAR_UUID,
+               BLE_COMMAND_CHAR_LENGTH,
+               command_props,
+               &p_service->command_handles);
+  ble_char_add(p_service,
+               BLE_TIME_CHAR_UUID,
+               BLE_TIME_CHAR_LENGTH,
+               write_props,
+               &p_service->time_handles);
+  ble_char_add(p_service,
+               BLE_HISTORY_LAYOUT_UUID,
+               HISTORY_LAYOUT_LENGTH,
+               read_props,
+               &p_service->history_layout_handles);
+  ble_char_add(p_service,
+               BLE_BATCH_CHAR_UUID,
+               BLE_BATCH_CHAR_LENGTH,
+               notify_props,
+               &p_service->batch_handles);
+  ble_char_add(p_service,
+               BLE_CHANGE_CHAR_UUID,
+               BLE_CHANGE_CHAR_LENGTH,
+               notify_props,
+               &p_service->change_handles);
+  ble_char_add(p_service,
+               BLE_STREAM_CHAR_UUID,
+               BLE_NOTIFY_MAX_LENGTH,
+               notify_props,
+               &p_service->stream_handles);
+  ble_char_add(p_service,
+               BLE_CAPTURE_CHAR_UUID,
+               BLE_NOTIFY_MAX_LENGTH,
+               notify_props,
+               &p_service->capture_handles);
+  ble_char_add(p_service,
+               BLE_PACK_CHAR_UUID,
+               sizeof(chain_record_t),
+               notify_props,
+               &p_service->pack_handles);
+  ble_char_add(p_service,
+               BLE_TRACE_CHAR_UUID,
+               BLE_NOTIFY_MAX_LENGTH,
+               notify_props,
+               &p_service->trace_handles);
+  ble_char_add(p_service,
+               BLE_CONFIG_CHAR_UUID,
+               sizeof(config_t),
+               write_props,
+               &p_service->config_handles);
+  ble_char_add(p_service,
+               BLE_SUMMARY_CHAR_UUID,
+               sizeof(summary_record_t),
+               notify_props,
+               &p_service->summary_handles);
+
+  uint8_t layout[HISTORY_LAYOUT_LENGTH];
+  ble_gatts_value_t gatts_val = {.len = history_get_layout(layout),
+                                 .offset = 0,
+                                 .p_value = layout};
+  err_code = sd_ble_gatts_value_set(
+      BLE_CONN_HANDLE_INVALID,
+      p_service->history_layout_handles.value_handle,
+      &gatts_val);
+  ERROR_CHECK("history layout value set", err_code);
 }
\ No newline at end of file
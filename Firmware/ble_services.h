@@ -4,14 +4,96 @@
 #include <stdint.h>
 
 #include "bluetooth.h"
+#include "data.h"
+#include "history.h"
+#include "summary.h"
+#include "sdk_config.h"
 
-// 2 bytes * (8 voltages + 8 currents) * 6 data points per notification
-#define BLE_HISTORY_CHAR_LENGTH (sizeof(uint16_t) * (8 + 8) * 6)
+// ATT notification header takes 3 bytes of the MTU
+#define BLE_NOTIFY_MAX_LENGTH   (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
 
-enum { VALUES, DEVIATIONS, HISTORY_1H, HISTORY_12H, PWM_SET };
+// as many history records as fit into a single notification
+#define BLE_HISTORY_RECORDS \
+  (BLE_NOTIFY_MAX_LENGTH / sizeof(history_record_t))
+#define BLE_HISTORY_CHAR_LENGTH (sizeof(history_record_t) * BLE_HISTORY_RECORDS)
 
-void ble_notify_cell_values(uint16_t values[16], uint8_t type);
-void ble_notify_history_values(uint16_t values[16], uint8_t type);
+// one reporting period of the batched live stream
+typedef struct {
+  uint64_t timestamp;  // in milliseconds, see timestamp.h
+  uint16_t values[2 * NUMBER_OF_CELLS];
+  uint16_t deviations[2 * NUMBER_OF_CELLS];
+} ble_batch_record_t;
+
+// as many reporting periods as fit into a single notification
+#define BLE_BATCH_MAX_RECORDS \
+  (BLE_NOTIFY_MAX_LENGTH / sizeof(ble_batch_record_t))
+#define BLE_BATCH_CHAR_LENGTH \
+  (sizeof(ble_batch_record_t) * BLE_BATCH_MAX_RECORDS)
+
+// sparse change report, only values that left their deadband are sent
+// the mask is padded to whole uint16 so the values stay aligned
+#define BLE_CHANGE_MASK_BYTES (((4 * NUMBER_OF_CELLS + 15) / 16) * 2)
+
+typedef struct {
+  uint64_t timestamp;  // in milliseconds, see timestamp.h
+  // bit i set: values[i] present, values then deviations, little endian
+  uint8_t changed[BLE_CHANGE_MASK_BYTES];
+  uint16_t values[4 * NUMBER_OF_CELLS];
+} ble_change_record_t;
+
+#define BLE_CHANGE_CHAR_LENGTH sizeof(ble_change_record_t)
+
+typedef enum {
+  BLE_DEADBAND_VOLTAGE,
+  BLE_DEADBAND_CURRENT,
+  BLE_DEADBAND_VOLTAGE_DEVIATION,
+  BLE_DEADBAND_CURRENT_DEVIATION,
+  BLE_DEADBAND_COUNT
+} ble_deadband_t;
+
+enum {
+  VALUES,
+  DEVIATIONS,
+  HISTORY_1H,
+  HISTORY_12H,
+  COMMAND,
+  TIME,
+  HISTORY_LAYOUT,
+  BATCH,
+  CHANGES,
+  STREAM,
+  CAPTURE,
+  PACK,
+  TRACE,
+  CONFIG,
+  SUMMARY,
+  CHAR_TYPE_COUNT
+};
+
+bool is_notification_enabled(uint8_t link, uint8_t type);
+void ble_set_notification_enabled(uint8_t link, uint8_t type, bool is_enabled);
+void ble_reset_notification_enabled(uint8_t link);
+uint8_t ble_get_subscribers(uint8_t type);
+
+void ble_notify_cell_values(data_record_t const *p_record, uint8_t type);
+void ble_notify_batch(data_record_t const *p_values,
+                      data_record_t const *p_deviations);
+bool ble_set_batch_size(uint8_t size);
+void ble_notify_changes(data_record_t const *p_values,
+                        data_record_t const *p_deviations);
+bool ble_set_deadband(uint8_t lane, uint16_t deadband);
+bool ble_set_heartbeat(uint16_t periods);
+uint8_t ble_get_history_records(uint8_t links);
+void ble_notify_history_values(uint8_t links,
+                               history_record_t records[],
+                               uint8_t count,
+                               uint8_t type);
+void ble_notify_command_response(uint8_t link,
+                                 uint8_t const *p_data,
+                                 uint16_t length);
+void ble_update_time_value(uint64_t unix_time);
+void ble_update_config_value(void const *p_config);
+void ble_notify_summary(summary_record_t const *p_record);
 void ble_service_init(ble_os_t *p_service);
 
 #endif  // BLE_SERVICES_H
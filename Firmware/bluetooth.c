@@ -2,24 +2,30 @@
 
 #include "app_timer.h"
 #include "ble_advertising.h"
+#include "ble_queue.h"
 #include "ble_conn_params.h"
 #include "ble_gap.h"
 #include "ble_services.h"
 #include "board.h"
+#include "boot.h"
+#include "capture.h"
+#include "command.h"
+#include "config.h"
 #include "history.h"
 #include "nrf_ble_gatt.h"
 #include "nrf_ble_qwr.h"
 #include "nrf_log_ctrl.h"
-#include "nrf_pwr_mgmt.h"
 #include "nrf_sdh.h"
 #include "nrf_sdh_ble.h"
-#include "pwm.h"
+#include "timestamp.h"
+#include "trace.h"
 
 #define NRF_LOG_MODULE_NAME ble
 #include "log.h"
 NRF_LOG_MODULE_REGISTER();
 
-#define DEVICE_NAME                    "8-Cell Balancer"
+#define DEVICE_NAME \
+  STRINGIFY(BOARD_CELL_COUNT) "-Cell Balancer"
 
 #define APP_BLE_OBSERVER_PRIO          3
 #define APP_BLE_CONN_CFG_TAG           1
@@ -31,22 +37,31 @@ NRF_LOG_MODULE_REGISTER();
 // in units of seconds
 #define APP_ADV_DURATION               BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED
 
+// fast advertising interval and duration are in the config
 // in units of 0.625 ms
-#define FAST_ADVERTISEMENT_INTERVAL    64
 #define SLOW_ADVERTISEMENT_INTERVAL    640
 // in units of 10 ms
-#define FAST_ADVERTISEMENT_DURATION    3000
 #define SLOW_ADVERTISEMENT_DURATION    3000
 
-// GAP connection parameters
-// Minimum acceptable connection interval (0.5 seconds).
-#define MIN_CONN_INTERVAL              MSEC_TO_UNITS(100, UNIT_1_25_MS)
-// Maximum acceptable connection interval (1 second).
-#define MAX_CONN_INTERVAL              MSEC_TO_UNITS(200, UNIT_1_25_MS)
-// Slave latency.
-#define SLAVE_LATENCY                  0
-// Connection supervisory time-out (4 seconds).
-#define CONN_SUP_TIMEOUT               MSEC_TO_UNITS(4000, UNIT_10_MS)
+// telemetry in extended advertising data, invisible to legacy-only scanners
+#define BROADCAST_ENABLED              0
+// Bluetooth SIG company identifier reserved for testing
+#define BROADCAST_COMPANY_ID           0xFFFF
+#define BROADCAST_VERSION              1
+#define BROADCAST_STATE_BALANCING      (1 << 0)
+
+// GAP connection parameters per workload, see workload_conn_params
+// Supervision timeout has to exceed (1 + latency) * max interval * 2.
+typedef enum {
+  BLE_WORKLOAD_IDLE,     // connected, nothing subscribed
+  BLE_WORKLOAD_LIVE,     // live values subscribed, one report per second
+  BLE_WORKLOAD_COMMAND,  // client is writing, keep response time low
+  BLE_WORKLOAD_BULK,     // history or waveform download
+  BLE_WORKLOAD_COUNT
+} ble_workload_t;
+
+// Command workload is left after this time without client writes.
+#define COMMAND_WORKLOAD_TIMEOUT       APP_TIMER_TICKS(5000)
 
 // Time from initiating event (connect or start of notification) to first time
 // sd_ble_gap_conn_param_update is called (15 seconds).
@@ -57,16 +72,127 @@ NRF_LOG_MODULE_REGISTER();
 // Number of attempts before giving up the connection parameter negotiation.
 #define MAX_CONN_PARAMS_UPDATE_COUNT   3
 
+static const ble_gap_conn_params_t workload_conn_params[BLE_WORKLOAD_COUNT] = {
+    [BLE_WORKLOAD_IDLE] =
+        {
+            .min_conn_interval = MSEC_TO_UNITS(400, UNIT_1_25_MS),
+            .max_conn_interval = MSEC_TO_UNITS(500, UNIT_1_25_MS),
+            .slave_latency = 4,
+            .conn_sup_timeout = MSEC_TO_UNITS(6000, UNIT_10_MS),
+        },
+    [BLE_WORKLOAD_LIVE] =
+        {
+            .min_conn_interval = MSEC_TO_UNITS(200, UNIT_1_25_MS),
+            .max_conn_interval = MSEC_TO_UNITS(250, UNIT_1_25_MS),
+            .slave_latency = 3,
+            .conn_sup_timeout = MSEC_TO_UNITS(4000, UNIT_10_MS),
+        },
+    [BLE_WORKLOAD_COMMAND] =
+        {
+            .min_conn_interval = MSEC_TO_UNITS(30, UNIT_1_25_MS),
+            .max_conn_interval = MSEC_TO_UNITS(50, UNIT_1_25_MS),
+            .slave_latency = 0,
+            .conn_sup_timeout = MSEC_TO_UNITS(4000, UNIT_10_MS),
+        },
+    [BLE_WORKLOAD_BULK] =
+        {
+            .min_conn_interval = MSEC_TO_UNITS(7.5, UNIT_1_25_MS),
+            .max_conn_interval = MSEC_TO_UNITS(15, UNIT_1_25_MS),
+            .slave_latency = 0,
+            .conn_sup_timeout = MSEC_TO_UNITS(4000, UNIT_10_MS),
+        },
+};
+
+STATIC_ASSERT(BLE_LINK_COUNT <= 8, "link masks are 8 bit");
+
 NRF_BLE_GATT_DEF(gatt_instance);
-NRF_BLE_QWR_DEF(qwr_instance);
+NRF_BLE_QWRS_DEF(qwr_instances, BLE_LINK_COUNT);
 BLE_ADVERTISING_DEF(advertising_instance);
 
-static ble_os_t service = {.connection_handle = BLE_CONN_HANDLE_INVALID};
+static ble_os_t service = {
+    .connection_handles = {[0 ... BLE_LINK_COUNT - 1] =
+                               BLE_CONN_HANDLE_INVALID}};
+
+typedef struct {
+  bool is_active;
+  uint64_t start_time;
+  uint32_t start_bytes;
+} ble_bulk_t;
+
+typedef struct {
+  ble_workload_t workload;
+  bool is_command_active;
+  ble_bulk_t bulk;
+} ble_link_t;
+
+static ble_link_t links[BLE_LINK_COUNT];
+
+// manufacturer specific advertising payload, refreshed every report
+typedef struct {
+  uint8_t version;
+  uint8_t state;  // BROADCAST_STATE_* bits
+  uint16_t sequence;
+  uint16_t values[2 * NUMBER_OF_CELLS];  // voltage 1, current 1, ...
+} ble_broadcast_t;
+
+static ble_broadcast_t broadcast = {.version = BROADCAST_VERSION};
+static ble_advdata_manuf_data_t broadcast_data = {
+    .company_identifier = BROADCAST_COMPANY_ID,
+    .data = {.size = sizeof(broadcast), .p_data = (uint8_t *)&broadcast},
+};
+
+// achieved by the last bulk transfer on any link
+static uint32_t bulk_bytes_per_second = 0;
+
+// one command timeout per link, APP_TIMER_DEF only defines single timers
+static app_timer_t command_timer_data[BLE_LINK_COUNT];
+static app_timer_id_t command_timers[BLE_LINK_COUNT];
 
 ble_os_t *ble_get_service(void) { return &service; }
-static void timers_init(void) {
-  ret_code_t err_code = app_timer_init();
-  ERROR_CHECK("app timer init", err_code);
+
+uint8_t ble_get_link(uint16_t connection_handle) {
+  if (connection_handle == BLE_CONN_HANDLE_INVALID) {
+    return BLE_LINK_INVALID;
+  }
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (service.connection_handles[link] == connection_handle) {
+      return link;
+    }
+  }
+  return BLE_LINK_INVALID;
+}
+
+static uint8_t ble_get_free_link(void) {
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (service.connection_handles[link] == BLE_CONN_HANDLE_INVALID) {
+      return link;
+    }
+  }
+  return BLE_LINK_INVALID;
+}
+
+uint8_t ble_get_connected_links(void) {
+  uint8_t connected = 0;
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (service.connection_handles[link] != BLE_CONN_HANDLE_INVALID) {
+      connected |= BLE_LINK(link);
+    }
+  }
+  return connected;
+}
+
+// the smallest payload of the links, the ATT header takes 3 bytes of the
+// MTU negotiated per link, at most BLE_NOTIFY_MAX_LENGTH
+uint16_t ble_get_notify_length(uint8_t links) {
+  uint16_t length = BLE_NOTIFY_MAX_LENGTH;
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    uint16_t handle = service.connection_handles[link];
+    if ((links & BLE_LINK(link)) && (handle != BLE_CONN_HANDLE_INVALID)) {
+      uint16_t mtu = nrf_ble_gatt_eff_mtu_get(&gatt_instance, handle);
+      length = MIN(length, mtu - 3);
+    }
+  }
+  return length;
 }
 
 static void gap_init(void) {
@@ -80,19 +206,29 @@ static void gap_init(void) {
       &sec_mode, (const uint8_t *)DEVICE_NAME, strlen(DEVICE_NAME));
   ERROR_CHECK("connection parameter init", err_code);
 
-  memset(&gap_conn_params, 0, sizeof(gap_conn_params));
-
-  gap_conn_params.min_conn_interval = MIN_CONN_INTERVAL;
-  gap_conn_params.max_conn_interval = MAX_CONN_INTERVAL;
-  gap_conn_params.slave_latency = SLAVE_LATENCY;
-  gap_conn_params.conn_sup_timeout = CONN_SUP_TIMEOUT;
+  // service discovery right after connecting is a command workload
+  gap_conn_params = workload_conn_params[BLE_WORKLOAD_COMMAND];
 
   err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
   ERROR_CHECK("gap ppcp set", err_code);
 }
 
+static void gatt_event_handler(nrf_ble_gatt_t *p_gatt,
+                               nrf_ble_gatt_evt_t const *p_evt) {
+  switch (p_evt->evt_id) {
+    case NRF_BLE_GATT_EVT_ATT_MTU_UPDATED:
+      NRF_LOG_INFO("GATT event: MTU %i", p_evt->params.att_mtu_effective);
+      break;
+    case NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED:
+      NRF_LOG_INFO("GATT event: data length %i", p_evt->params.data_length);
+      break;
+    default:
+      break;
+  }
+}
+
 static void gatt_init(void) {
-  ret_code_t err_code = nrf_ble_gatt_init(&gatt_instance, NULL);
+  ret_code_t err_code = nrf_ble_gatt_init(&gatt_instance, gatt_event_handler);
   ERROR_CHECK("gatt init", err_code);
 }
 
@@ -100,6 +236,7 @@ static void advertising_start(void) {
   ret_code_t err_code =
       ble_advertising_start(&advertising_instance, BLE_ADV_MODE_FAST);
   ERROR_CHECK("advertising start", err_code);
+  boot_stage(BOOT_STAGE_ADVERTISING);
 }
 
 static void ble_adverting_handler(ble_adv_evt_t ble_adv_evt) {
@@ -128,20 +265,62 @@ static void ble_adverting_handler(ble_adv_evt_t ble_adv_evt) {
   }
 }
 
+static void advertising_data_set(ble_advdata_t *p_advdata) {
+  memset(p_advdata, 0, sizeof(*p_advdata));
+  p_advdata->name_type = BLE_ADVDATA_FULL_NAME;
+  p_advdata->include_appearance = true;
+  p_advdata->flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+  if (BROADCAST_ENABLED) {
+    p_advdata->p_manuf_specific_data = &broadcast_data;
+  }
+}
+
+void ble_broadcast_update(data_record_t const *p_values, bool is_balancing) {
+  if (!BROADCAST_ENABLED) {
+    return;
+  }
+
+  broadcast.state = is_balancing ? BROADCAST_STATE_BALANCING : 0;
+  broadcast.sequence++;
+  memcpy(broadcast.values, p_values->values, sizeof(broadcast.values));
+
+  // also fine while not advertising, the data is used on the next start
+  ble_advdata_t advdata;
+  advertising_data_set(&advdata);
+  ret_code_t err_code =
+      ble_advertising_advdata_update(&advertising_instance, &advdata, NULL);
+  ERROR_CHECK("broadcast advertising data update", err_code);
+}
+
+static void advertising_modes_set(ble_adv_modes_config_t *p_modes) {
+  memset(p_modes, 0, sizeof(*p_modes));
+  p_modes->ble_adv_extended_enabled = BROADCAST_ENABLED;
+  p_modes->ble_adv_primary_phy = BLE_GAP_PHY_1MBPS;
+  p_modes->ble_adv_secondary_phy = BLE_GAP_PHY_1MBPS;
+  p_modes->ble_adv_fast_enabled = true;
+  p_modes->ble_adv_slow_enabled = false;
+  p_modes->ble_adv_fast_interval = config_get()->advertising_interval;
+  p_modes->ble_adv_fast_timeout = config_get()->advertising_duration;
+  p_modes->ble_adv_slow_interval = SLOW_ADVERTISEMENT_INTERVAL;
+  p_modes->ble_adv_slow_timeout = SLOW_ADVERTISEMENT_DURATION;
+  // restarted by the event handler as long as a link is free
+  p_modes->ble_adv_on_disconnect_disabled = true;
+}
+
+// takes effect on the next advertising start
+void ble_advertising_update(void) {
+  ble_adv_modes_config_t modes;
+  advertising_modes_set(&modes);
+  ble_advertising_modes_config_set(&advertising_instance, &modes);
+}
+
 static void advertising_init(void) {
   ret_code_t err_code;
   ble_advertising_init_t init;
 
   memset(&init, 0, sizeof(init));
-  init.advdata.name_type = BLE_ADVDATA_FULL_NAME;
-  init.advdata.include_appearance = true;
-  init.advdata.flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
-  init.config.ble_adv_fast_enabled = true;
-  init.config.ble_adv_slow_enabled = false;
-  init.config.ble_adv_fast_interval = FAST_ADVERTISEMENT_INTERVAL;
-  init.config.ble_adv_fast_timeout = FAST_ADVERTISEMENT_DURATION;
-  init.config.ble_adv_slow_interval = SLOW_ADVERTISEMENT_INTERVAL;
-  init.config.ble_adv_slow_timeout = SLOW_ADVERTISEMENT_DURATION;
+  advertising_data_set(&init.advdata);
+  advertising_modes_set(&init.config);
   init.evt_handler = ble_adverting_handler;
   init.error_handler = NULL;
 
@@ -160,8 +339,10 @@ static void qwr_init(void) {
 
   qwr_init.error_handler = nrf_qwr_error_handler;
 
-  err_code = nrf_ble_qwr_init(&qwr_instance, &qwr_init);
-  ERROR_CHECK("qwr init", err_code);
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    err_code = nrf_ble_qwr_init(&qwr_instances[link], &qwr_init);
+    ERROR_CHECK("qwr init", err_code);
+  }
 }
 
 static void connection_params_event_handler(ble_conn_params_evt_t *p_evt) {
@@ -183,6 +364,132 @@ static void connection_params_error_handler(uint32_t nrf_error) {
   NRF_LOG_ERROR("Connection parameters error %s", nrf_strerror_get(nrf_error));
 }
 
+static void connection_event_extension_set(bool is_enabled) {
+  ble_opt_t opt;
+  memset(&opt, 0, sizeof(opt));
+  opt.common_opt.conn_evt_ext.enable = is_enabled;
+
+  ret_code_t err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+  ERROR_CHECK("connection event extension set", err_code);
+}
+
+static ble_workload_t ble_workload_get(uint8_t link) {
+  if (links[link].bulk.is_active) {
+    return BLE_WORKLOAD_BULK;
+  } else if (links[link].is_command_active) {
+    return BLE_WORKLOAD_COMMAND;
+  } else if (is_notification_enabled(link, VALUES) ||
+             is_notification_enabled(link, DEVIATIONS) ||
+             is_notification_enabled(link, BATCH)) {
+    return BLE_WORKLOAD_LIVE;
+  }
+  return BLE_WORKLOAD_IDLE;
+}
+
+// renegotiates the connection parameters whenever the workload changes
+static void ble_workload_update(uint8_t link) {
+  uint16_t connection_handle = service.connection_handles[link];
+  if (connection_handle == BLE_CONN_HANDLE_INVALID) {
+    return;
+  }
+
+  ble_workload_t next_workload = ble_workload_get(link);
+  if (next_workload == links[link].workload) {
+    return;
+  }
+  links[link].workload = next_workload;
+  NRF_LOG_DEBUG("link %i workload %i", link, next_workload);
+
+  ble_gap_conn_params_t conn_params = workload_conn_params[next_workload];
+  ret_code_t err_code =
+      ble_conn_params_change_conn_params(connection_handle, &conn_params);
+  ERROR_CHECK("connection parameter change", err_code);
+}
+
+static void command_timeout_handler(void *p_context) {
+  uint8_t link = (uint8_t)(uintptr_t)p_context;
+  links[link].is_command_active = false;
+  ble_workload_update(link);
+}
+
+static void ble_workload_command(uint8_t link) {
+  ret_code_t err_code;
+
+  links[link].is_command_active = true;
+  err_code = app_timer_stop(command_timers[link]);
+  ERROR_CHECK("command timer stop", err_code);
+  err_code = app_timer_start(command_timers[link],
+                             COMMAND_WORKLOAD_TIMEOUT,
+                             (void *)(uintptr_t)link);
+  ERROR_CHECK("command timer start", err_code);
+  ble_workload_update(link);
+}
+
+static bool ble_bulk_is_active(void) {
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (links[link].bulk.is_active) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ble_bulk_start(uint8_t link) {
+  ret_code_t err_code;
+  ble_bulk_t *p_bulk = &links[link].bulk;
+  uint16_t connection_handle = service.connection_handles[link];
+
+  if (p_bulk->is_active || (connection_handle == BLE_CONN_HANDLE_INVALID)) {
+    return;
+  }
+
+  ble_gap_phys_t const phys = {
+      .rx_phys = BLE_GAP_PHY_2MBPS,
+      .tx_phys = BLE_GAP_PHY_2MBPS,
+  };
+  err_code = sd_ble_gap_phy_update(connection_handle, &phys);
+  ERROR_CHECK("bulk phy update", err_code);
+
+  // NULL requests the maximum data length supported by the softdevice
+  err_code = sd_ble_gap_data_length_update(connection_handle, NULL, NULL);
+  ERROR_CHECK("bulk data length update", err_code);
+
+  // event extension is a global option, kept on while any link is bulk
+  connection_event_extension_set(true);
+
+  // throughput covers all links, exact as long as one link downloads
+  p_bulk->is_active = true;
+  p_bulk->start_time = timestamp_get_uptime();
+  p_bulk->start_bytes = ble_queue_get_stats()->bytes;
+  ble_workload_update(link);
+  NRF_LOG_INFO("link %i bulk transfer started", link);
+}
+
+void ble_bulk_stop(uint8_t link) {
+  ble_bulk_t *p_bulk = &links[link].bulk;
+
+  if (!p_bulk->is_active) {
+    return;
+  }
+  p_bulk->is_active = false;
+
+  uint32_t duration = (uint32_t)(timestamp_get_uptime() - p_bulk->start_time);
+  uint32_t bytes = ble_queue_get_stats()->bytes - p_bulk->start_bytes;
+  bulk_bytes_per_second = (uint64_t)bytes * 1000 / MAX(duration, 1);
+  NRF_LOG_INFO("link %i bulk transfer: %u bytes in %u ms, %u B/s",
+               link,
+               bytes,
+               duration,
+               bulk_bytes_per_second);
+
+  if (!ble_bulk_is_active()) {
+    connection_event_extension_set(false);
+  }
+  ble_workload_update(link);
+}
+
+uint32_t ble_bulk_get_throughput(void) { return bulk_bytes_per_second; }
+
 static void connection_init(void) {
   ret_code_t err_code;
   ble_conn_params_init_t cp_init;
@@ -194,59 +501,95 @@ static void connection_init(void) {
   cp_init.next_conn_params_update_delay = NEXT_CONN_PARAMS_UPDATE_DELAY;
   cp_init.max_conn_params_update_count = MAX_CONN_PARAMS_UPDATE_COUNT;
   cp_init.start_on_notify_cccd_handle = BLE_GATT_HANDLE_INVALID;
-  cp_init.disconnect_on_fail = true;
+  cp_init.disconnect_on_fail = false;  // parameters change with the workload
   cp_init.evt_handler = connection_params_event_handler;
   cp_init.error_handler = connection_params_error_handler;
 
   err_code = ble_conn_params_init(&cp_init);
   ERROR_CHECK("connection parameter init", err_code);
+
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    command_timers[link] = &command_timer_data[link];
+    err_code = app_timer_create(&command_timers[link],
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                command_timeout_handler);
+    ERROR_CHECK("command timer create", err_code);
+  }
 }
 
-static void on_gatts_event_write(ble_evt_t const *p_ble_evt) {
+static void on_gatts_event_write(uint8_t link, ble_evt_t const *p_ble_evt) {
   ble_gatts_evt_write_t const *p_evt = &p_ble_evt->evt.gatts_evt.params.write;
   uint16_t attr_handle = p_evt->handle;
 
   if (attr_handle == service.values_handles.cccd_handle) {
     NRF_LOG_INFO("values characteristic notify %s",
                  p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, VALUES, p_evt->data[0]);
   } else if (attr_handle == service.deviation_handles.cccd_handle) {
     NRF_LOG_INFO("deviation characteristic notify %s",
                  p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, DEVIATIONS, p_evt->data[0]);
+  } else if (attr_handle == service.batch_handles.cccd_handle) {
+    NRF_LOG_INFO("batch characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, BATCH, p_evt->data[0]);
+  } else if (attr_handle == service.change_handles.cccd_handle) {
+    NRF_LOG_INFO("change characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, CHANGES, p_evt->data[0]);
+  } else if (attr_handle == service.stream_handles.cccd_handle) {
+    NRF_LOG_INFO("stream characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, STREAM, p_evt->data[0]);
+    if (p_evt->data[0]) {
+      ble_bulk_start(link);
+    }
+  } else if (attr_handle == service.capture_handles.cccd_handle) {
+    NRF_LOG_INFO("capture characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, CAPTURE, p_evt->data[0]);
+  } else if (attr_handle == service.pack_handles.cccd_handle) {
+    NRF_LOG_INFO("pack characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, PACK, p_evt->data[0]);
+  } else if (attr_handle == service.trace_handles.cccd_handle) {
+    NRF_LOG_INFO("trace characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, TRACE, p_evt->data[0]);
+  } else if (attr_handle == service.summary_handles.cccd_handle) {
+    NRF_LOG_INFO("summary characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, SUMMARY, p_evt->data[0]);
   } else if (attr_handle == service.history_1h_handles.cccd_handle) {
     NRF_LOG_INFO("history 1h characteristic notify %s",
                  p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, HISTORY_1H, p_evt->data[0]);
     if (p_evt->data[0]) {
-      history_notify_1h_full();
+      history_notify_1h_full(link);
     }
   } else if (attr_handle == service.history_12h_handles.cccd_handle) {
     NRF_LOG_INFO("history 12h characteristic notify %s",
                  p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, HISTORY_12H, p_evt->data[0]);
     if (p_evt->data[0]) {
-      history_notify_12h_full();
+      history_notify_12h_full(link);
     }
-  } else if (attr_handle == service.pwm_set_handles.value_handle) {
-    NRF_LOG_INFO("pwm characteristic written");
-    uint8_t const *p_data = p_evt->data;
-    uint16_t values[8];
-    for (size_t i = 0; i < 8; i++) {
-      char str[3 + 1] = {'\0'};
-      strncpy(str, (char *)p_data + (i * 4), 3);
-      values[i] = atoi(str);
+  } else if (attr_handle == service.command_handles.cccd_handle) {
+    NRF_LOG_INFO("command characteristic notify %s",
+                 p_evt->data[0] ? "enabled" : "disabled");
+    ble_set_notification_enabled(link, COMMAND, p_evt->data[0]);
+  } else if (attr_handle == service.command_handles.value_handle) {
+    command_process(link, p_evt->data, p_evt->len);
+  } else if (attr_handle == service.config_handles.value_handle) {
+    config_write(p_evt->data, p_evt->len);
+  } else if (attr_handle == service.time_handles.value_handle) {
+    if (p_evt->len == sizeof(uint64_t)) {
+      uint64_t unix_time;
+      memcpy(&unix_time, p_evt->data, sizeof(unix_time));
+      timestamp_sync(unix_time);
+    } else {
+      NRF_LOG_WARNING("time characteristic invalid length %i", p_evt->len);
     }
-    static char value_string[51] = {};  // static for logger
-    snprintf(value_string,
-             sizeof(value_string),
-             "pwm values: %i, %i, %i, %i, %i, %i, %i, %i",
-             values[0],
-             values[1],
-             values[2],
-             values[3],
-             values[4],
-             values[5],
-             values[6],
-             values[7]);
-    NRF_LOG_INFO("%s", value_string);
-    pwm_update_values(values);
   } else {
     NRF_LOG_WARNING("Unmapped attribute written %i", attr_handle);
   }
@@ -254,29 +597,67 @@ static void on_gatts_event_write(ble_evt_t const *p_ble_evt) {
 
 static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
   ret_code_t err_code;
+  // every gap and gatts event carries the connection handle at the same offset
+  uint16_t connection_handle = p_ble_evt->evt.gap_evt.conn_handle;
+  uint8_t link = ble_get_link(connection_handle);
 
   uint16_t event_id = p_ble_evt->header.evt_id;
+  trace_record(TRACE_BLE_BEGIN, event_id);
   switch (event_id) {
     case BLE_GAP_EVT_CONNECTED:
-      NRF_LOG_INFO("Stack event: Connected");
+      link = ble_get_free_link();
+      if (link == BLE_LINK_INVALID) {
+        NRF_LOG_ERROR("Stack event: Connected without a free link");
+        break;
+      }
+      NRF_LOG_INFO("Stack event: Connected, link %i", link);
       nrf_gpio_pin_clear(CONNECTED_LED);
       nrf_gpio_pin_set(ADVERTISE_LED);
-      service.connection_handle = p_ble_evt->evt.gap_evt.conn_handle;
-      err_code = nrf_ble_qwr_conn_handle_assign(&qwr_instance,
-                                                service.connection_handle);
+      service.connection_handles[link] = connection_handle;
+      err_code = nrf_ble_qwr_conn_handle_assign(&qwr_instances[link],
+                                                connection_handle);
       ERROR_CHECK("qwr connection handle assign", err_code);
-      err_code =
-          sd_ble_gatts_sys_attr_set(service.connection_handle, NULL, 0, 0);
+      err_code = sd_ble_gatts_sys_attr_set(connection_handle, NULL, 0, 0);
       ERROR_CHECK("system attribute set", err_code);
+      ble_reset_notification_enabled(link);
+      links[link].workload = BLE_WORKLOAD_COUNT;
+      ble_workload_command(link);
+      if (ble_get_connected_links() != BLE_LINKS_ALL) {
+        advertising_start();  // keep accepting centrals
+      }
       break;
     case BLE_GAP_EVT_DISCONNECTED:
-      NRF_LOG_INFO("Stack event: Disconnected");
-      nrf_gpio_pin_set(CONNECTED_LED);
-      service.connection_handle = BLE_CONN_HANDLE_INVALID;
-      // advertising_start();
+      if (link == BLE_LINK_INVALID) {
+        break;
+      }
+      NRF_LOG_INFO("Stack event: Disconnected, link %i", link);
+      bool was_full = ble_get_connected_links() == BLE_LINKS_ALL;
+      service.connection_handles[link] = BLE_CONN_HANDLE_INVALID;
+      ble_reset_notification_enabled(link);
+      ble_queue_clear(link);
+      ble_bulk_stop(link);
+      links[link].is_command_active = false;
+      err_code = app_timer_stop(command_timers[link]);
+      ERROR_CHECK("command timer stop", err_code);
+      if (ble_get_connected_links() == 0) {
+        nrf_gpio_pin_set(CONNECTED_LED);
+      }
+      if (was_full) {
+        advertising_start();  // a link is free again
+      }
       break;
     case BLE_GAP_EVT_CONN_PARAM_UPDATE:
-      NRF_LOG_INFO("Stack event: Connection parameters updated");
+      NRF_LOG_INFO(
+          "Stack event: Connection parameters updated, interval %i, latency %i",
+          p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params
+              .max_conn_interval,
+          p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params
+              .slave_latency);
+      break;
+    case BLE_GAP_EVT_PHY_UPDATE:
+      NRF_LOG_INFO("Stack event: PHY updated, tx %i, rx %i",
+                   p_ble_evt->evt.gap_evt.params.phy_update.tx_phy,
+                   p_ble_evt->evt.gap_evt.params.phy_update.rx_phy);
       break;
     case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
       NRF_LOG_DEBUG("Stack event: PHY update request");
@@ -284,15 +665,18 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
           .rx_phys = BLE_GAP_PHY_AUTO,
           .tx_phys = BLE_GAP_PHY_AUTO,
       };
-      err_code =
-          sd_ble_gap_phy_update(p_ble_evt->evt.gap_evt.conn_handle, &phys);
+      err_code = sd_ble_gap_phy_update(connection_handle, &phys);
       ERROR_CHECK("gap phy update", err_code);
       break;
     case BLE_GAP_EVT_ADV_SET_TERMINATED:
       NRF_LOG_DEBUG("Stack event: Advertising terminated");
       break;
     case BLE_GATTS_EVT_WRITE:
-      on_gatts_event_write(p_ble_evt);
+      if (link == BLE_LINK_INVALID) {
+        break;
+      }
+      on_gatts_event_write(link, p_ble_evt);
+      ble_workload_command(link);
       break;
     case BLE_GATTS_EVT_SYS_ATTR_MISSING:
       NRF_LOG_DEBUG("Stack event: SYS attr missing");
@@ -301,12 +685,24 @@ static void ble_event_handler(ble_evt_t const *p_ble_evt, void *p_context) {
       NRF_LOG_DEBUG("Stack event: Exchange MTU request");
       break;
     case BLE_GATTS_EVT_HVN_TX_COMPLETE:
-      NRF_LOG_DEBUG("Stack event: Notification transmission complete");
+      // refill the softdevice queue, history dumps top up the bulk queue
+      ble_queue_flush();
+      history_notify_continue();
+      capture_notify_continue();
+      trace_notify_continue();
+      for (uint8_t i = 0; i < BLE_LINK_COUNT; i++) {
+        if (ble_queue_is_empty(BLE_QUEUE_BULK, i) &&
+            !history_is_dump_active(i) && !capture_is_dump_active(i) &&
+            !trace_is_dump_active(i) && !is_notification_enabled(i, STREAM)) {
+          ble_bulk_stop(i);
+        }
+      }
       break;
     default:
       NRF_LOG_WARNING("Stack event: Unmapped ID 0x%x (%i)", event_id, event_id);
       break;
   }
+  trace_record(TRACE_BLE_END, event_id);
 }
 
 static void soft_device_init(void) {
@@ -348,16 +744,10 @@ static void soft_device_init(void) {
   //     ble_advertising_on_ble_evt, NULL);
 }
 
-static void power_management_init(void) {
-  ret_code_t err_code;
-  err_code = nrf_pwr_mgmt_init();
-  ERROR_CHECK("power management init", err_code);
-}
-
+// blocks until the low frequency clock runs, the SAADC keeps sampling
 void ble_init(void) {
-  timers_init();
-  power_management_init();
   soft_device_init();
+  boot_stage(BOOT_STAGE_SOFTDEVICE);
   gap_init();
   gatt_init();
   qwr_init();
@@ -1,19 +1,46 @@
 #ifndef BLUETOOTH_H
 #define BLUETOOTH_H
 
+#include "data.h"
 #include "nrf_ble_gatt.h"
+#include "sdk_config.h"
+
+// every connected central gets a link index, per-link state is indexed by it
+#define BLE_LINK_COUNT   NRF_SDH_BLE_PERIPHERAL_LINK_COUNT
+#define BLE_LINK_INVALID 0xff
+// bit mask of link indices, one bit per link
+#define BLE_LINK(_link)  (1 << (_link))
+#define BLE_LINKS_ALL    (BLE_LINK(BLE_LINK_COUNT) - 1)
 
 typedef struct {
-  uint16_t connection_handle;
+  uint16_t connection_handles[BLE_LINK_COUNT];
   uint16_t service_handle;
   ble_gatts_char_handles_t values_handles;
   ble_gatts_char_handles_t deviation_handles;
   ble_gatts_char_handles_t history_1h_handles;
   ble_gatts_char_handles_t history_12h_handles;
-  ble_gatts_char_handles_t pwm_set_handles;
+  ble_gatts_char_handles_t command_handles;
+  ble_gatts_char_handles_t time_handles;
+  ble_gatts_char_handles_t history_layout_handles;
+  ble_gatts_char_handles_t batch_handles;
+  ble_gatts_char_handles_t change_handles;
+  ble_gatts_char_handles_t stream_handles;
+  ble_gatts_char_handles_t capture_handles;
+  ble_gatts_char_handles_t pack_handles;
+  ble_gatts_char_handles_t trace_handles;
+  ble_gatts_char_handles_t config_handles;
+  ble_gatts_char_handles_t summary_handles;
 } ble_os_t;
 
 void ble_init(void);
 ble_os_t* ble_get_service(void);
+uint8_t ble_get_link(uint16_t connection_handle);
+uint8_t ble_get_connected_links(void);
+uint16_t ble_get_notify_length(uint8_t links);
+void ble_bulk_start(uint8_t link);
+void ble_bulk_stop(uint8_t link);
+uint32_t ble_bulk_get_throughput(void);
+void ble_advertising_update(void);
+void ble_broadcast_update(data_record_t const* p_values, bool is_balancing);
 
 #endif  // BLUETOOTH_H
@@ -0,0 +1,79 @@
+#include "boot.h"
+
+#include "app_util_platform.h"
+#include "nrf_timer.h"
+#include "trace.h"
+
+#define NRF_LOG_MODULE_NAME boot
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// a TIMER counts through sleep and runs before the low frequency clock,
+// unlike the DWT cycle counter and the RTC, it is stopped after the boot
+#define BOOT_TIMER NRF_TIMER2
+
+static uint32_t boot_times[BOOT_STAGE_COUNT] = {
+    [0 ... BOOT_STAGE_COUNT - 1] = BOOT_TIME_NONE};
+
+static void boot_report(void) {
+  NRF_LOG_INFO("first measurement after %u us, advertising after %u us",
+               boot_times[BOOT_STAGE_MEASUREMENT],
+               boot_times[BOOT_STAGE_ADVERTISING]);
+  NRF_LOG_INFO("safety %u us, sampling %u us, SoftDevice %u us",
+               boot_times[BOOT_STAGE_SAFETY],
+               boot_times[BOOT_STAGE_SAMPLING],
+               boot_times[BOOT_STAGE_SOFTDEVICE]);
+  NRF_LOG_INFO("storage %u us, ready %u us",
+               boot_times[BOOT_STAGE_STORAGE],
+               boot_times[BOOT_STAGE_READY]);
+}
+
+// in microseconds since boot_init(), called from main and the SAADC handler
+static uint32_t boot_now(void) {
+  uint32_t now;
+  CRITICAL_REGION_ENTER();
+  nrf_timer_task_trigger(BOOT_TIMER, NRF_TIMER_TASK_CAPTURE0);
+  now = nrf_timer_cc_read(BOOT_TIMER, NRF_TIMER_CC_CHANNEL0);
+  CRITICAL_REGION_EXIT();
+  return now;
+}
+
+static bool boot_is_complete(void) {
+  for (size_t i = 0; i < BOOT_STAGE_COUNT; i++) {
+    if (boot_times[i] == BOOT_TIME_NONE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// only the first time a stage is reached counts, later calls are cheap
+void boot_stage(uint8_t stage) {
+  if ((BOOT_STAGE_COUNT <= stage) || (boot_times[stage] != BOOT_TIME_NONE)) {
+    return;
+  }
+  boot_times[stage] = boot_now();
+  trace_record(TRACE_BOOT_STAGE, stage);
+
+  if (stage == BOOT_STAGE_READY) {
+    boot_report();
+  }
+  // the timer keeps the high frequency clock running
+  if (boot_is_complete()) {
+    nrf_timer_task_trigger(BOOT_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(BOOT_TIMER, NRF_TIMER_TASK_SHUTDOWN);
+  }
+}
+
+// first thing in main(), the stage times count from here
+void boot_init(void) {
+  nrf_timer_mode_set(BOOT_TIMER, NRF_TIMER_MODE_TIMER);
+  nrf_timer_bit_width_set(BOOT_TIMER, NRF_TIMER_BIT_WIDTH_32);
+  nrf_timer_frequency_set(BOOT_TIMER, NRF_TIMER_FREQ_1MHz);
+  nrf_timer_task_trigger(BOOT_TIMER, NRF_TIMER_TASK_CLEAR);
+  nrf_timer_task_trigger(BOOT_TIMER, NRF_TIMER_TASK_START);
+}
+
+void boot_get_times(uint32_t times[BOOT_STAGE_COUNT]) {
+  memcpy(times, boot_times, sizeof(boot_times));
+}
@@ -0,0 +1,25 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+
+// in the order they are normally reached, keep in sync with Host-App
+typedef enum {
+  BOOT_STAGE_SAFETY,       // balancers off, protection armed
+  BOOT_STAGE_SAMPLING,     // SAADC calibrated, first block started
+  BOOT_STAGE_MEASUREMENT,  // first block checked by the protection
+  BOOT_STAGE_SOFTDEVICE,   // BLE stack enabled, low frequency clock running
+  BOOT_STAGE_ADVERTISING,  // first advertising started
+  BOOT_STAGE_STORAGE,      // stored calibration, chain and config loaded
+  BOOT_STAGE_READY,        // balancer PWM and schedule running
+  BOOT_STAGE_COUNT
+} boot_stage_t;
+
+// not reached yet
+#define BOOT_TIME_NONE UINT32_MAX
+
+void boot_init(void);
+void boot_stage(uint8_t stage);
+void boot_get_times(uint32_t times[BOOT_STAGE_COUNT]);
+
+#endif  // BOOT_H
@@ -0,0 +1,235 @@
+#include "calibration.h"
+
+#include "adc.h"
+#include "app_util_platform.h"
+#include "storage.h"
+
+#define NRF_LOG_MODULE_NAME calibration
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// nominal gain of the 825 mV reference behind the resistor dividers
+#define CALIBRATION_NOMINAL_GAIN(_divider)                            \
+  ((int32_t)(((int64_t)825 * (_divider) << CALIBRATION_SHIFT) /       \
+             (47 * ADC_RANGE)))
+#define CALIBRATION_VOLTAGE_DIVIDER 267
+#define CALIBRATION_CURRENT_DIVIDER 62
+
+#define CALIBRATION_VERSION         1
+#define CALIBRATION_POINT_COUNT     2
+// blocks of 8 samples summed per point, 512 samples in total
+#define CALIBRATION_POINT_BLOCKS    64
+#define CALIBRATION_POINT_SHIFT     9
+// measured gains further off than 1/4 of nominal are rejected
+#define CALIBRATION_GAIN_TOLERANCE  4
+// keeps the Q16 offset within int32
+#define CALIBRATION_REFERENCE_MAX   8000
+
+typedef struct {
+  uint32_t version;
+  calibration_entry_t entries[CALIBRATION_LANE_COUNT][NUMBER_OF_CELLS];
+} calibration_table_t;
+
+STATIC_ASSERT(sizeof(calibration_table_t) <= STORAGE_MAX_LENGTH,
+              "calibration table does not fit into a storage record");
+
+typedef struct {
+  uint16_t reference[CALIBRATION_POINT_COUNT];
+  int32_t raw[CALIBRATION_POINT_COUNT];  // sum of 1 << POINT_SHIFT samples
+  uint8_t measured;                      // bit per finished point
+} calibration_points_t;
+
+typedef struct {
+  uint8_t lane;
+  uint8_t cell;
+  uint8_t point;
+  uint8_t blocks;
+  int32_t sum;
+  bool is_active;
+} calibration_measurement_t;
+
+static const int32_t nominal_gains[CALIBRATION_LANE_COUNT] = {
+    [CALIBRATION_LANE_VOLTAGE] =
+        CALIBRATION_NOMINAL_GAIN(CALIBRATION_VOLTAGE_DIVIDER),
+    [CALIBRATION_LANE_CURRENT] =
+        CALIBRATION_NOMINAL_GAIN(CALIBRATION_CURRENT_DIVIDER),
+};
+
+static calibration_table_t table;
+static calibration_points_t points[CALIBRATION_LANE_COUNT][NUMBER_OF_CELLS];
+static calibration_measurement_t measurement;
+
+static bool calibration_is_valid(uint8_t lane, uint8_t cell) {
+  return (lane < CALIBRATION_LANE_COUNT) && (cell < NUMBER_OF_CELLS);
+}
+
+static void calibration_set_nominal(uint8_t lane, uint8_t cell) {
+  table.entries[lane][cell].gain = nominal_gains[lane];
+  table.entries[lane][cell].offset = 0;
+}
+
+static bool calibration_save(void) {
+  bool is_saved =
+      storage_write(STORAGE_KEY_CALIBRATION, &table, sizeof(table));
+  if (!is_saved) {
+    NRF_LOG_WARNING("calibration not stored");
+  }
+  return is_saved;
+}
+
+// raw is the sum of 1 << shift samples, only multiply and shift
+int32_t calibration_to_millis(uint8_t lane,
+                              uint8_t cell,
+                              int32_t raw,
+                              uint8_t shift) {
+  calibration_entry_t const *p_entry = &table.entries[lane][cell];
+  int64_t value = ((int64_t)raw * p_entry->gain) >> shift;
+  value += p_entry->offset + (1 << (CALIBRATION_SHIFT - 1));
+  return (int32_t)(value >> CALIBRATION_SHIFT);
+}
+
+// for differences like the block range, the offset cancels out
+int32_t calibration_scale(uint8_t lane, uint8_t cell, int32_t raw) {
+  int64_t value = (int64_t)raw * table.entries[lane][cell].gain;
+  value += 1 << (CALIBRATION_SHIFT - 1);
+  return (int32_t)(value >> CALIBRATION_SHIFT);
+}
+
+// inverse for thresholds, not on the sample path
+uint16_t calibration_to_raw(uint8_t lane, uint8_t cell, uint16_t millis) {
+  calibration_entry_t const *p_entry = &table.entries[lane][cell];
+  int64_t value = ((int64_t)millis << CALIBRATION_SHIFT) - p_entry->offset;
+  value /= p_entry->gain;
+  return (uint16_t)MIN(MAX(value, 0), ADC_RANGE - 1);
+}
+
+void calibration_measure(int32_t const voltage_sums[NUMBER_OF_CELLS],
+                         int32_t const current_sums[NUMBER_OF_CELLS]) {
+  if (!measurement.is_active) {
+    return;
+  }
+
+  int32_t const *p_sums = measurement.lane == CALIBRATION_LANE_VOLTAGE
+                              ? voltage_sums
+                              : current_sums;
+  measurement.sum += p_sums[measurement.cell];
+  measurement.blocks++;
+  if (measurement.blocks < CALIBRATION_POINT_BLOCKS) {
+    return;
+  }
+
+  calibration_points_t *p_points =
+      &points[measurement.lane][measurement.cell];
+  p_points->raw[measurement.point] = measurement.sum;
+  p_points->measured |= 1 << measurement.point;
+  measurement.is_active = false;
+  NRF_LOG_INFO("lane %i cell %i point %i measured",
+               measurement.lane,
+               measurement.cell,
+               measurement.point);
+}
+
+// the host applies a known reference to the cell before each point
+bool calibration_start_point(uint8_t lane,
+                             uint8_t cell,
+                             uint8_t point,
+                             uint16_t reference) {
+  if (!calibration_is_valid(lane, cell) ||
+      CALIBRATION_POINT_COUNT <= point || measurement.is_active ||
+      CALIBRATION_REFERENCE_MAX < reference) {
+    return false;
+  }
+
+  points[lane][cell].reference[point] = reference;
+  points[lane][cell].measured &= ~(1 << point);
+  measurement = (calibration_measurement_t){
+      .lane = lane, .cell = cell, .point = point, .is_active = true};
+
+  return true;
+}
+
+bool calibration_apply(uint8_t lane, uint8_t cell) {
+  if (!calibration_is_valid(lane, cell)) {
+    return false;
+  }
+
+  calibration_points_t const *p_points = &points[lane][cell];
+  if (p_points->measured != (1 << CALIBRATION_POINT_COUNT) - 1) {
+    return false;
+  }
+
+  int32_t raw_delta = p_points->raw[1] - p_points->raw[0];
+  int32_t reference_delta = p_points->reference[1] - p_points->reference[0];
+  if (raw_delta == 0) {
+    return false;
+  }
+
+  int64_t gain = ((int64_t)reference_delta
+                  << (CALIBRATION_SHIFT + CALIBRATION_POINT_SHIFT)) /
+                 raw_delta;
+  int32_t nominal = nominal_gains[lane];
+  if (ABS(gain - nominal) > nominal / CALIBRATION_GAIN_TOLERANCE) {
+    NRF_LOG_WARNING("lane %i cell %i gain out of range", lane, cell);
+    return false;
+  }
+
+  calibration_entry_t *p_entry = &table.entries[lane][cell];
+  p_entry->gain = (int32_t)gain;
+  p_entry->offset =
+      ((int32_t)p_points->reference[0] << CALIBRATION_SHIFT) -
+      (int32_t)(((int64_t)p_points->raw[0] * gain) >> CALIBRATION_POINT_SHIFT);
+  NRF_LOG_INFO("lane %i cell %i calibrated", lane, cell);
+
+  return calibration_save();  // fails when the table is not stored
+}
+
+bool calibration_reset(uint8_t lane, uint8_t cell) {
+  if (!calibration_is_valid(lane, cell)) {
+    return false;
+  }
+
+  calibration_set_nominal(lane, cell);
+  points[lane][cell].measured = 0;
+
+  return calibration_save();
+}
+
+bool calibration_get(uint8_t lane,
+                     uint8_t cell,
+                     calibration_entry_t *p_entry,
+                     uint8_t *p_points) {
+  if (!calibration_is_valid(lane, cell)) {
+    return false;
+  }
+
+  *p_entry = table.entries[lane][cell];
+  *p_points = points[lane][cell].measured;
+
+  return true;
+}
+
+// requires storage_init()
+// the first blocks are sampled with the stored table still unread
+void calibration_init(void) {
+  table.version = CALIBRATION_VERSION;
+  for (uint8_t lane = 0; lane < CALIBRATION_LANE_COUNT; lane++) {
+    for (uint8_t cell = 0; cell < NUMBER_OF_CELLS; cell++) {
+      calibration_set_nominal(lane, cell);
+    }
+  }
+}
+
+// requires storage_init(), the SAADC handler may already use the table
+void calibration_load(void) {
+  calibration_table_t stored;
+  if (!storage_read(STORAGE_KEY_CALIBRATION, &stored, sizeof(stored)) ||
+      stored.version != CALIBRATION_VERSION) {
+    NRF_LOG_INFO("nominal calibration");
+    return;
+  }
+
+  CRITICAL_REGION_ENTER();
+  memcpy(&table, &stored, sizeof(table));
+  CRITICAL_REGION_EXIT();
+  NRF_LOG_INFO("calibration loaded");
+}
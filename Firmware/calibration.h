@@ -0,0 +1,44 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data.h"
+
+// millis = (raw * gain >> shift + offset) >> CALIBRATION_SHIFT
+#define CALIBRATION_SHIFT 16
+
+typedef enum {
+  CALIBRATION_LANE_VOLTAGE,  // mV
+  CALIBRATION_LANE_CURRENT,  // mA
+  CALIBRATION_LANE_COUNT
+} calibration_lane_t;
+
+typedef struct {
+  int32_t gain;    // millis per LSB, Q16
+  int32_t offset;  // millis, Q16
+} calibration_entry_t;
+
+void calibration_init(void);
+void calibration_load(void);
+int32_t calibration_to_millis(uint8_t lane,
+                              uint8_t cell,
+                              int32_t raw,
+                              uint8_t shift);
+int32_t calibration_scale(uint8_t lane, uint8_t cell, int32_t raw);
+uint16_t calibration_to_raw(uint8_t lane, uint8_t cell, uint16_t millis);
+void calibration_measure(int32_t const voltage_sums[NUMBER_OF_CELLS],
+                         int32_t const current_sums[NUMBER_OF_CELLS]);
+bool calibration_start_point(uint8_t lane,
+                             uint8_t cell,
+                             uint8_t point,
+                             uint16_t reference);
+bool calibration_apply(uint8_t lane, uint8_t cell);
+bool calibration_reset(uint8_t lane, uint8_t cell);
+bool calibration_get(uint8_t lane,
+                     uint8_t cell,
+                     calibration_entry_t *p_entry,
+                     uint8_t *p_points);
+
+#endif  // CALIBRATION_H
@@ -0,0 +1,215 @@
+#include "capture.h"
+
+#include "adc.h"
+#include "ble_queue.h"
+#include "ble_services.h"
+#include "bluetooth.h"
+
+#define NRF_LOG_MODULE_NAME capture
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// number of rows kept, must be a power of two
+#define CAPTURE_ROWS       512
+#define CAPTURE_ROW_LENGTH (ADC_SLOT_COUNT * sizeof(nrf_saadc_value_t))
+
+typedef enum {
+  CAPTURE_IDLE,
+  CAPTURE_ARMED,      // filling the pre trigger window, waiting for trigger
+  CAPTURE_TRIGGERED,  // filling the post trigger window
+  CAPTURE_DONE,       // frozen until downloaded and armed again
+} capture_state_t;
+
+typedef struct {
+  capture_state_t state;
+  uint8_t trigger;
+  uint8_t slot;
+  int16_t level;
+  uint16_t pre;        // rows before the trigger row
+  uint16_t head;       // next row to write, free running
+  uint16_t filled;     // rows written since arming, saturates at CAPTURE_ROWS
+  uint16_t remaining;  // post trigger rows still to write
+  uint16_t start;      // first row of the frozen capture
+  nrf_saadc_value_t last;
+  bool is_pwm_changed;
+} capture_t;
+
+typedef struct {
+  uint16_t position;  // rows sent so far
+  bool is_active;
+} capture_dump_t;
+
+static nrf_saadc_value_t capture_rows[CAPTURE_ROWS][ADC_SLOT_COUNT];
+static capture_t capture = {.state = CAPTURE_IDLE};
+static capture_dump_t capture_dumps[BLE_LINK_COUNT];
+
+bool capture_is_dump_active(uint8_t link) {
+  return capture_dumps[link].is_active;
+}
+
+static bool capture_is_any_dump_active(void) {
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (capture_dumps[link].is_active) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool capture_arm(uint8_t trigger, uint8_t slot, int16_t level, uint16_t pre) {
+  if ((CAPTURE_TRIGGER_COUNT <= trigger) || (ADC_SLOT_COUNT <= slot) ||
+      (CAPTURE_ROWS <= pre)) {
+    return false;
+  }
+  // a distance of zero or less would fire on the first row
+  bool is_distance = (trigger == CAPTURE_TRIGGER_SLOPE) ||
+                     (trigger == CAPTURE_TRIGGER_DEVIATION);
+  if (is_distance && (level <= 0)) {
+    return false;
+  }
+  // the buffer is read in place by running downloads
+  if (capture_is_any_dump_active()) {
+    return false;
+  }
+
+  capture.trigger = trigger;
+  capture.slot = slot;
+  capture.level = level;
+  capture.pre = pre;
+  capture.filled = 0;
+  capture.is_pwm_changed = false;
+  capture.state = CAPTURE_ARMED;
+  NRF_LOG_INFO("armed, trigger %i on slot %i at %i", trigger, slot, level);
+  return true;
+}
+
+void capture_pwm_changed(void) { capture.is_pwm_changed = true; }
+
+static void capture_dump(capture_dump_t *p_dump, uint8_t link) {
+  uint8_t packet[BLE_NOTIFY_MAX_LENGTH];
+  uint16_t handle = ble_get_service()->capture_handles.value_handle;
+  // a link without room for one row drops the packets in the queue
+  uint16_t length = MAX(ble_get_notify_length(BLE_LINK(link)),
+                        CAPTURE_HEADER_LENGTH + CAPTURE_ROW_LENGTH);
+  uint8_t packet_rows = (length - CAPTURE_HEADER_LENGTH) / CAPTURE_ROW_LENGTH;
+
+  while (p_dump->is_active && ble_queue_has_space(BLE_QUEUE_BULK, link)) {
+    if (!is_notification_enabled(link, CAPTURE)) {
+      p_dump->is_active = false;
+      break;
+    }
+
+    uint8_t rows = MIN(packet_rows, CAPTURE_ROWS - p_dump->position);
+    packet[0] = p_dump->position & 0xff;
+    packet[1] = p_dump->position >> 8;
+    packet[2] = capture.pre & 0xff;
+    packet[3] = capture.pre >> 8;
+    packet[4] = rows;
+    for (size_t i = 0; i < rows; i++) {
+      uint16_t row = (capture.start + p_dump->position++) & (CAPTURE_ROWS - 1);
+      memcpy(&packet[CAPTURE_HEADER_LENGTH + i * CAPTURE_ROW_LENGTH],
+             capture_rows[row],
+             CAPTURE_ROW_LENGTH);
+    }
+    ble_queue_push(BLE_QUEUE_BULK,
+                   BLE_LINK(link),
+                   handle,
+                   packet,
+                   CAPTURE_HEADER_LENGTH + rows * CAPTURE_ROW_LENGTH);
+
+    if (p_dump->position == CAPTURE_ROWS) {
+      p_dump->is_active = false;
+    }
+  }
+  ble_queue_flush();
+}
+
+bool capture_read(uint8_t link) {
+  if (capture.state != CAPTURE_DONE) {
+    return false;
+  }
+
+  capture_dumps[link].position = 0;
+  capture_dumps[link].is_active = true;
+  ble_bulk_start(link);
+  capture_dump(&capture_dumps[link], link);
+  return true;
+}
+
+void capture_notify_continue(void) {
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    capture_dump(&capture_dumps[link], link);
+  }
+}
+
+static bool capture_is_triggered(nrf_saadc_value_t value, int16_t deviation) {
+  switch (capture.trigger) {
+    case CAPTURE_TRIGGER_RISING:
+      return (capture.last < capture.level) && (capture.level <= value);
+    case CAPTURE_TRIGGER_FALLING:
+      return (capture.level < capture.last) && (value <= capture.level);
+    case CAPTURE_TRIGGER_SLOPE:
+      return capture.level <= ABS(value - capture.last);
+    case CAPTURE_TRIGGER_DEVIATION:
+      return capture.level <= deviation;
+    case CAPTURE_TRIGGER_PWM:
+      return capture.is_pwm_changed;
+    default:
+      return false;
+  }
+}
+
+static void capture_finish(void) {
+  capture.state = CAPTURE_DONE;
+  capture.start = capture.head - CAPTURE_ROWS;
+  NRF_LOG_INFO("capture complete");
+
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (is_notification_enabled(link, CAPTURE)) {
+      capture_read(link);
+    }
+  }
+}
+
+// runs in the SAADC handler, only copies rows and never waits for the radio
+void capture_process_buffer(nrf_saadc_value_t const *p_buffer) {
+  if ((capture.state == CAPTURE_IDLE) || (capture.state == CAPTURE_DONE)) {
+    return;
+  }
+
+  nrf_saadc_value_t min = INT16_MAX;
+  nrf_saadc_value_t max = INT16_MIN;
+  for (size_t row = 0; row < ADC_ROW_COUNT; row++) {
+    nrf_saadc_value_t value = p_buffer[row * ADC_SLOT_COUNT + capture.slot];
+    min = MIN(min, value);
+    max = MAX(max, value);
+  }
+
+  for (size_t row = 0; row < ADC_ROW_COUNT; row++) {
+    nrf_saadc_value_t const *p_row = &p_buffer[row * ADC_SLOT_COUNT];
+    memcpy(capture_rows[capture.head++ & (CAPTURE_ROWS - 1)],
+           p_row,
+           CAPTURE_ROW_LENGTH);
+    capture.filled = MIN(capture.filled + 1, CAPTURE_ROWS);
+
+    nrf_saadc_value_t value = p_row[capture.slot];
+    if (capture.state == CAPTURE_ARMED) {
+      // first row only seeds the previous value
+      if ((capture.pre < capture.filled) && (1 < capture.filled) &&
+          capture_is_triggered(value, max - min)) {
+        NRF_LOG_INFO("triggered");
+        capture.state = CAPTURE_TRIGGERED;
+        capture.remaining = CAPTURE_ROWS - capture.pre - 1;
+      }
+    } else {
+      capture.remaining--;
+    }
+    capture.last = value;
+
+    if ((capture.state == CAPTURE_TRIGGERED) && (capture.remaining == 0)) {
+      capture_finish();
+      break;
+    }
+  }
+  capture.is_pwm_changed = false;
+}
@@ -0,0 +1,29 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nrf_saadc.h"
+
+// notification: offset of the first row (uint16), trigger row (uint16), row
+// count (uint8), then raw samples of all ADC_SLOT_COUNT slots per row as int16
+#define CAPTURE_HEADER_LENGTH 5
+
+typedef enum {
+  CAPTURE_TRIGGER_RISING,     // slot crosses level upwards
+  CAPTURE_TRIGGER_FALLING,    // slot crosses level downwards
+  CAPTURE_TRIGGER_SLOPE,      // slot changes by level between two rows
+  CAPTURE_TRIGGER_DEVIATION,  // max - min of one buffer exceeds level
+  CAPTURE_TRIGGER_PWM,        // any balancer duty changes
+  CAPTURE_TRIGGER_COUNT
+} capture_trigger_t;
+
+void capture_process_buffer(nrf_saadc_value_t const *p_buffer);
+bool capture_arm(uint8_t trigger, uint8_t slot, int16_t level, uint16_t pre);
+bool capture_read(uint8_t link);
+void capture_notify_continue(void);
+bool capture_is_dump_active(uint8_t link);
+void capture_pwm_changed(void);
+
+#endif  // CAPTURE_H
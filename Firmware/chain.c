@@ -0,0 +1,290 @@
+#include "chain.h"
+
+#include "ble_queue.h"
+#include "ble_services.h"
+#include "board.h"
+#include "crc16.h"
+#include "filter.h"
+#include "nrfx_uarte.h"
+#include "protection.h"
+#include "pwm.h"
+#include "storage.h"
+#include "timestamp.h"
+#include "trace.h"
+
+#define NRF_LOG_MODULE_NAME chain
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define CHAIN_FRAME_START     0xA5
+#define CHAIN_FLAG_BALANCING  0x01
+// rounds without a valid frame before falling back to the local cells
+#define CHAIN_MAX_MISSED      3
+
+// summary of one board, filtered estimates of the last control step
+typedef struct {
+  uint16_t voltages[NUMBER_OF_CELLS];
+  uint16_t currents[NUMBER_OF_CELLS];
+} chain_summary_t;
+
+// the head starts a frame every round, every board fills in its summary and
+// passes it on, all boards run the same firmware so the layout is shared
+typedef struct {
+  uint8_t start;  // CHAIN_FRAME_START, receivers hunt for it
+  uint8_t sequence;
+  uint8_t count;   // summaries already filled in
+  uint8_t flags;   // CHAIN_FLAG_BALANCING of the head
+  uint8_t faults;  // bit per board with a protection trip
+  uint8_t reserved;
+  uint16_t lowest;  // pack minimum elected by the head in the last round
+  uint16_t target;  // termination voltage of the head
+  chain_summary_t summaries[CHAIN_MAX_BOARDS];
+  uint16_t crc;
+} chain_frame_t;
+
+typedef struct {
+  uint8_t boards;    // 1 means standalone
+  uint8_t position;  // 0 is the head
+} chain_config_t;
+
+STATIC_ASSERT(sizeof(chain_record_t) <= BLE_NOTIFY_MAX_LENGTH,
+              "pack record does not fit into a notification");
+
+static const nrfx_uarte_t uarte = NRFX_UARTE_INSTANCE(1);
+
+static chain_config_t config = {.boards = 1, .position = 0};
+static bool is_initialized = false;
+
+static chain_frame_t rx_frame;
+static chain_frame_t tx_frame;  // EasyDMA reads it while it is sent
+static uint8_t sequence = 0;
+static uint8_t missed = 0;
+static uint16_t pack_lowest = PWM_PACK_LOWEST_NONE;
+
+static uint16_t chain_crc(chain_frame_t const *p_frame) {
+  return crc16_compute(
+      (uint8_t const *)p_frame, offsetof(chain_frame_t, crc), NULL);
+}
+
+static void chain_hunt(void) {
+  nrfx_err_t status = nrfx_uarte_rx(&uarte, &rx_frame.start, 1);
+  ERROR_CHECK("chain rx", status);
+}
+
+static void chain_send(chain_frame_t const *p_frame) {
+  if (nrfx_uarte_tx_in_progress(&uarte)) {
+    NRF_LOG_WARNING("frame %i dropped, uart busy", p_frame->sequence);
+    return;
+  }
+  memcpy(&tx_frame, p_frame, sizeof(tx_frame));
+  tx_frame.crc = chain_crc(&tx_frame);
+
+  nrfx_err_t status =
+      nrfx_uarte_tx(&uarte, (uint8_t const *)&tx_frame, sizeof(tx_frame));
+  ERROR_CHECK("chain tx", status);
+}
+
+static void chain_fill_summary(chain_frame_t *p_frame) {
+  chain_summary_t *p_summary = &p_frame->summaries[p_frame->count];
+  filter_get_estimates(FILTER_LANE_VOLTAGE, p_summary->voltages);
+  filter_get_estimates(FILTER_LANE_CURRENT, p_summary->currents);
+  if (protection_is_tripped()) {
+    p_frame->faults |= 1 << p_frame->count;
+  }
+  p_frame->count++;
+}
+
+static void chain_notify_pack(chain_frame_t const *p_frame) {
+  static chain_record_t record;  // kept off the stack, queue copies it
+  uint8_t links = ble_get_subscribers(PACK);
+  if (links == 0) {
+    return;
+  }
+
+  record.timestamp = timestamp_to_unix(timestamp_get_uptime());
+  record.boards = p_frame->count;
+  record.faults = p_frame->faults;
+  record.lowest = pack_lowest;
+  for (size_t i = 0; i < p_frame->count; i++) {
+    for (size_t k = 0; k < NUMBER_OF_CELLS; k++) {
+      size_t cell = i * NUMBER_OF_CELLS + k;
+      record.values[2 * cell] = p_frame->summaries[i].voltages[k];
+      record.values[2 * cell + 1] = p_frame->summaries[i].currents[k];
+    }
+  }
+
+  ble_queue_push(BLE_QUEUE_LIVE,
+                 links,
+                 ble_get_service()->pack_handles.value_handle,
+                 (uint8_t *)&record,
+                 offsetof(chain_record_t, values) +
+                     p_frame->count * 2 * NUMBER_OF_CELLS * sizeof(uint16_t));
+}
+
+// the frame made it around the ring, the head elects the next minimum
+static void chain_elect(chain_frame_t const *p_frame) {
+  if (p_frame->count != config.boards) {
+    NRF_LOG_WARNING("%i of %i boards answered", p_frame->count, config.boards);
+    return;
+  }
+
+  uint16_t lowest = PWM_PACK_LOWEST_NONE;
+  for (size_t i = 0; i < p_frame->count; i++) {
+    for (size_t k = 0; k < NUMBER_OF_CELLS; k++) {
+      uint16_t voltage = p_frame->summaries[i].voltages[k];
+      if (PWM_MIN_CELL_VOLTAGE < voltage) {
+        lowest = MIN(voltage, lowest);
+      }
+    }
+  }
+  pack_lowest = lowest;
+  pwm_set_pack_lowest(pack_lowest);
+  chain_notify_pack(p_frame);
+}
+
+// the other boards take over the decisions of the head
+static void chain_follow(chain_frame_t const *p_frame) {
+  pwm_set_pack_lowest(p_frame->lowest);
+  // a corrupt or invalid target of the head is not taken over
+  if ((p_frame->target != pwm_get_target()) &&
+      pwm_is_target_valid(p_frame->target)) {
+    pwm_set_target(p_frame->target);
+  }
+  bool is_balancing = p_frame->flags & CHAIN_FLAG_BALANCING;
+  if (is_balancing != pwm_is_balancer_active()) {
+    pwm_set_balancer_state(is_balancing);
+  }
+}
+
+static void chain_receive(chain_frame_t const *p_frame) {
+  if (chain_crc(p_frame) != p_frame->crc) {
+    NRF_LOG_WARNING("frame crc mismatch");
+    return;
+  }
+  trace_record(TRACE_CHAIN_FRAME, p_frame->sequence);
+  missed = 0;
+
+  if (config.position == 0) {
+    chain_elect(p_frame);
+    return;
+  }
+  if (p_frame->count != config.position) {
+    NRF_LOG_WARNING("frame of position %i, check wiring", p_frame->count);
+    return;
+  }
+
+  chain_follow(p_frame);
+  chain_frame_t frame;
+  memcpy(&frame, p_frame, sizeof(frame));
+  chain_fill_summary(&frame);
+  chain_send(&frame);
+}
+
+static void uarte_handler(nrfx_uarte_event_t const *p_event, void *p_context) {
+  switch (p_event->type) {
+    case NRFX_UARTE_EVT_RX_DONE:
+      if (p_event->data.rxtx.p_data == &rx_frame.start) {
+        if (rx_frame.start != CHAIN_FRAME_START) {
+          chain_hunt();
+          break;
+        }
+        nrfx_err_t status = nrfx_uarte_rx(
+            &uarte, &rx_frame.sequence, sizeof(rx_frame) - 1);
+        ERROR_CHECK("chain rx", status);
+        break;
+      }
+      chain_receive(&rx_frame);
+      chain_hunt();
+      break;
+    case NRFX_UARTE_EVT_TX_DONE:
+      break;
+    case NRFX_UARTE_EVT_ERROR:
+      NRF_LOG_WARNING("uart error 0x%x", p_event->data.error.error_mask);
+      chain_hunt();
+      break;
+    default:
+      break;
+  }
+}
+
+static void chain_uarte_init(void) {
+  nrfx_uarte_config_t uarte_config = NRFX_UARTE_DEFAULT_CONFIG;
+  uarte_config.pseltxd = CHAIN_TX_PIN;
+  uarte_config.pselrxd = CHAIN_RX_PIN;
+  uarte_config.baudrate = NRF_UARTE_BAUDRATE_115200;
+  uarte_config.interrupt_priority = APP_IRQ_PRIORITY_LOW;
+
+  nrfx_err_t status = nrfx_uarte_init(&uarte, &uarte_config, uarte_handler);
+  ERROR_CHECK("chain uart init", status);
+  is_initialized = true;
+  chain_hunt();
+}
+
+// called by the schedule on every board
+void chain_round(void) {
+  if (config.boards == 1) {
+    return;
+  }
+
+  if (missed < UINT8_MAX) {
+    missed++;
+  }
+  if (missed == CHAIN_MAX_MISSED) {
+    NRF_LOG_WARNING("chain lost, balancing on local cells");
+    pack_lowest = PWM_PACK_LOWEST_NONE;
+    pwm_set_pack_lowest(pack_lowest);
+  }
+  if (config.position != 0) {
+    return;
+  }
+
+  chain_frame_t frame = {
+      .start = CHAIN_FRAME_START,
+      .sequence = sequence++,
+      .flags = pwm_is_balancer_active() ? CHAIN_FLAG_BALANCING : 0,
+      .lowest = pack_lowest,
+      .target = pwm_get_target(),
+  };
+  chain_fill_summary(&frame);
+  chain_send(&frame);
+}
+
+bool chain_configure(uint8_t boards, uint8_t position) {
+  if ((boards == 0) || (CHAIN_MAX_BOARDS < boards) || (boards <= position)) {
+    return false;
+  }
+
+  config.boards = boards;
+  config.position = position;
+  missed = 0;
+  pack_lowest = PWM_PACK_LOWEST_NONE;
+  pwm_set_pack_lowest(pack_lowest);
+  if ((boards != 1) && !is_initialized) {
+    chain_uarte_init();
+  }
+  if ((boards == 1) && is_initialized) {
+    nrfx_uarte_uninit(&uarte);
+    is_initialized = false;
+  }
+
+  storage_write(STORAGE_KEY_CHAIN, &config, sizeof(config));
+  NRF_LOG_INFO("chain of %i boards, position %i", boards, position);
+  return true;
+}
+
+// requires storage_init()
+void chain_init(void) {
+  chain_config_t stored;
+  if (!storage_read(STORAGE_KEY_CHAIN, &stored, sizeof(stored)) ||
+      (stored.boards == 0) || (CHAIN_MAX_BOARDS < stored.boards) ||
+      (stored.boards <= stored.position)) {
+    return;
+  }
+
+  config = stored;
+  if (config.boards != 1) {
+    chain_uarte_init();
+  }
+  NRF_LOG_INFO(
+      "chain of %i boards, position %i", config.boards, config.position);
+}
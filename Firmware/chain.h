@@ -0,0 +1,27 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data.h"
+
+// boards are wired as a ring over the spare UARTE, TX to the RX of the next
+// board, the head (position 0) talks to the host and elects the pack minimum
+#define CHAIN_MAX_BOARDS 4
+#define CHAIN_MAX_CELLS  (CHAIN_MAX_BOARDS * NUMBER_OF_CELLS)
+
+// pack notification of the head, cells ordered by position in the chain
+typedef struct {
+  uint64_t timestamp;  // in milliseconds, see timestamp.h
+  uint8_t boards;      // boards that answered in the last round
+  uint8_t faults;      // bit per board with a protection trip
+  uint16_t lowest;     // elected pack minimum in millivolt
+  uint16_t values[2 * CHAIN_MAX_CELLS];  // voltage, current per cell
+} chain_record_t;
+
+void chain_init(void);
+void chain_round(void);
+bool chain_configure(uint8_t boards, uint8_t position);
+
+#endif  // CHAIN_H
@@ -0,0 +1,651 @@
+#include "command.h"
+
+#include "adc.h"
+#include "ble_services.h"
+#include "bluetooth.h"
+#include "boot.h"
+#include "calibration.h"
+#include "capture.h"
+#include "chain.h"
+#include "data.h"
+#include "filter.h"
+#include "power.h"
+#include "protection.h"
+#include "pwm.h"
+#include "schedule.h"
+#include "stream.h"
+#include "trace.h"
+
+#define NRF_LOG_MODULE_NAME command
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// opcode, status and length in front of every response payload
+#define COMMAND_RESPONSE_HEADER  3
+// largest response payload of the query commands
+#define COMMAND_QUERY_PAYLOAD       (1 + 2 + NUMBER_OF_CELLS)
+#define COMMAND_CAL_QUERY_PAYLOAD   (4 + 4 + 1)
+#define COMMAND_POWER_QUERY_PAYLOAD (1 + 2 + 2 + 2)
+#define COMMAND_BOOT_QUERY_PAYLOAD  (4 * BOOT_STAGE_COUNT)
+#define COMMAND_RESPONSE_PAYLOAD                                  \
+  MAX(MAX(COMMAND_QUERY_PAYLOAD, COMMAND_CAL_QUERY_PAYLOAD),      \
+      MAX(COMMAND_POWER_QUERY_PAYLOAD, COMMAND_BOOT_QUERY_PAYLOAD))
+
+STATIC_ASSERT(1 + COMMAND_RESPONSE_HEADER + COMMAND_RESPONSE_PAYLOAD <=
+                  BLE_NOTIFY_MAX_LENGTH,
+              "command response does not fit a notification");
+
+typedef struct {
+  uint8_t data[BLE_NOTIFY_MAX_LENGTH];
+  uint16_t length;
+} command_response_t;
+
+static uint16_t command_read_u16(uint8_t const *p_data) {
+  return p_data[0] | (p_data[1] << 8);
+}
+
+// masks are sent with as many little endian bytes as they need
+static uint32_t command_read_mask(uint8_t const *p_data, uint8_t bytes) {
+  uint32_t mask = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    mask |= (uint32_t)p_data[i] << (8 * i);
+  }
+  return mask;
+}
+
+static void command_write_mask(uint8_t *p_data, uint32_t mask, uint8_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    p_data[i] = (mask >> (8 * i)) & 0xff;
+  }
+}
+
+static command_status_t command_set_duty(uint8_t const *p_payload,
+                                         uint8_t length) {
+  if (length < CELL_MASK_BYTES) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  cell_mask_t mask = command_read_mask(p_payload, CELL_MASK_BYTES);
+  uint8_t count = 0;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    count += (mask >> i) & 1;
+  }
+  if (length != CELL_MASK_BYTES + count) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (protection_is_tripped()) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  uint16_t values[NUMBER_OF_CELLS];
+  pwm_get_values(values);
+  uint8_t const *p_duty = &p_payload[CELL_MASK_BYTES];
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (mask & ((cell_mask_t)1 << i)) {
+      if (PWM_TOP_VALUE < *p_duty) {
+        return COMMAND_STATUS_INVALID_VALUE;
+      }
+      values[i] = *p_duty++;
+    }
+  }
+  pwm_update_values(values);
+  NRF_LOG_INFO("duty set, mask 0x%x", mask);
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_mode(uint8_t const *p_payload,
+                                         uint8_t length) {
+  if (length != 1) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (COMMAND_MODE_COUNT <= p_payload[0]) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+  if (p_payload[0] != COMMAND_MODE_MANUAL && protection_is_tripped()) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  // entering one of the automatic modes leaves the other
+  if (p_payload[0] == COMMAND_MODE_CURRENT) {
+    pwm_set_current_state(true);
+  } else if (p_payload[0] == COMMAND_MODE_BALANCING) {
+    pwm_set_balancer_state(true);
+  } else {
+    pwm_set_balancer_state(false);
+    pwm_set_current_state(false);
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_current(uint8_t const *p_payload,
+                                            uint8_t length) {
+  if (length < CELL_MASK_BYTES) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  cell_mask_t mask = command_read_mask(p_payload, CELL_MASK_BYTES);
+  uint8_t count = 0;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    count += (mask >> i) & 1;
+  }
+  if (length != CELL_MASK_BYTES + 2 * count) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  uint16_t currents[NUMBER_OF_CELLS] = {0};
+  uint8_t const *p_current = &p_payload[CELL_MASK_BYTES];
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (mask & ((cell_mask_t)1 << i)) {
+      currents[i] = command_read_u16(p_current);
+      // the target has to stay clear of the overcurrent trip
+      if (protection_get_current_limit() <= currents[i]) {
+        return COMMAND_STATUS_INVALID_VALUE;
+      }
+      p_current += 2;
+    }
+  }
+  pwm_set_target_currents(mask, currents);
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_target(uint8_t const *p_payload,
+                                           uint8_t length) {
+  if (length != 2) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  uint16_t voltage = command_read_u16(p_payload);
+  if (!pwm_set_target(voltage)) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_batch(uint8_t const *p_payload,
+                                          uint8_t length) {
+  if (length != 1) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!ble_set_batch_size(p_payload[0])) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_deadband(uint8_t const *p_payload,
+                                             uint8_t length) {
+  if (length != 3) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!ble_set_deadband(p_payload[0], command_read_u16(&p_payload[1]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_heartbeat(uint8_t const *p_payload,
+                                              uint8_t length) {
+  if (length != 2) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!ble_set_heartbeat(command_read_u16(p_payload))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_rate(uint8_t const *p_payload,
+                                         uint8_t length) {
+  if (length != 3) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!schedule_set_period(p_payload[0], command_read_u16(&p_payload[1]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_stream(uint8_t const *p_payload,
+                                           uint8_t length) {
+  if (length != ADC_SLOT_MASK_BYTES + 1) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!stream_configure(command_read_mask(p_payload, ADC_SLOT_MASK_BYTES),
+                        p_payload[ADC_SLOT_MASK_BYTES])) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_capture_arm(uint8_t const *p_payload,
+                                            uint8_t length) {
+  if (length != 6) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!capture_arm(p_payload[0],
+                   p_payload[1],
+                   (int16_t)command_read_u16(&p_payload[2]),
+                   command_read_u16(&p_payload[4]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_capture_read(uint8_t link, uint8_t length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!capture_read(link)) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_limits(uint8_t const *p_payload,
+                                           uint8_t length) {
+  if (length != 4) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!protection_set_limits(command_read_u16(p_payload),
+                             command_read_u16(&p_payload[2]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_filter(uint8_t const *p_payload,
+                                           uint8_t length) {
+  if (length != 3) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!filter_set_process_noise(p_payload[0],
+                                command_read_u16(&p_payload[1]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_report(uint8_t const *p_payload,
+                                           uint8_t length) {
+  if (length != 1) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (COMMAND_REPORT_COUNT <= p_payload[0]) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+  data_set_fast_report(p_payload[0] == COMMAND_REPORT_FILTERED);
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_cal_point(uint8_t const *p_payload,
+                                          uint8_t length) {
+  if (length != 5) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!calibration_start_point(p_payload[0],
+                               p_payload[1],
+                               p_payload[2],
+                               command_read_u16(&p_payload[3]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_cal_apply(uint8_t const *p_payload,
+                                          uint8_t length) {
+  if (length != 2) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!calibration_apply(p_payload[0], p_payload[1])) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_cal_reset(uint8_t const *p_payload,
+                                          uint8_t length) {
+  if (length != 2) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!calibration_reset(p_payload[0], p_payload[1])) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_chain(uint8_t const *p_payload,
+                                          uint8_t length) {
+  if (length != 2) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!chain_configure(p_payload[0], p_payload[1])) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_trace_start(uint8_t length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  trace_start();
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_trace_read(uint8_t link,
+                                           uint8_t const *p_payload,
+                                           uint8_t length) {
+  if (length != 1) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (1 < p_payload[0]) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+  if (!trace_read(p_payload[0] ? BLE_LINK_INVALID : link)) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_set_power(uint8_t const *p_payload,
+                                          uint8_t length) {
+  if (length != 3) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  if (!power_set_policy(p_payload[0], command_read_u16(&p_payload[1]))) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_power_query(uint8_t length,
+                                            uint8_t *p_response,
+                                            uint8_t *p_response_length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  power_stats_t stats;
+  power_get_stats(&stats);
+  p_response[0] = stats.mode;
+  memcpy(&p_response[1], &stats.sleep_permille, sizeof(uint16_t));
+  memcpy(&p_response[3], &stats.current_ua, sizeof(uint16_t));
+  memcpy(&p_response[5], &stats.block_rate, sizeof(uint16_t));
+  *p_response_length = COMMAND_POWER_QUERY_PAYLOAD;
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_boot_query(uint8_t length,
+                                           uint8_t *p_response,
+                                           uint8_t *p_response_length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  uint32_t times[BOOT_STAGE_COUNT];
+  boot_get_times(times);
+  memcpy(p_response, times, sizeof(times));
+  *p_response_length = COMMAND_BOOT_QUERY_PAYLOAD;
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_cal_query(uint8_t const *p_payload,
+                                          uint8_t length,
+                                          uint8_t *p_response,
+                                          uint8_t *p_response_length) {
+  if (length != 2) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  calibration_entry_t entry;
+  if (!calibration_get(p_payload[0], p_payload[1], &entry, &p_response[8])) {
+    return COMMAND_STATUS_INVALID_VALUE;
+  }
+  memcpy(&p_response[0], &entry.gain, sizeof(entry.gain));
+  memcpy(&p_response[4], &entry.offset, sizeof(entry.offset));
+  *p_response_length = COMMAND_CAL_QUERY_PAYLOAD;
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_fault_query(uint8_t length,
+                                            uint8_t *p_response,
+                                            uint8_t *p_response_length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  cell_mask_t cells;
+  p_response[0] = protection_get_fault(&cells);
+  command_write_mask(&p_response[1], cells, CELL_MASK_BYTES);
+  *p_response_length = 1 + CELL_MASK_BYTES;
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_fault_clear(uint8_t length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+  protection_clear();
+
+  return COMMAND_STATUS_OK;
+}
+
+static command_status_t command_query(uint8_t length,
+                                      uint8_t *p_response,
+                                      uint8_t *p_response_length) {
+  if (length != 0) {
+    return COMMAND_STATUS_INVALID_LENGTH;
+  }
+
+  uint16_t values[NUMBER_OF_CELLS];
+  pwm_get_values(values);
+  uint16_t target = pwm_get_target();
+
+  p_response[0] = COMMAND_MODE_MANUAL;
+  if (pwm_is_balancer_active()) {
+    p_response[0] = COMMAND_MODE_BALANCING;
+  } else if (pwm_is_current_active()) {
+    p_response[0] = COMMAND_MODE_CURRENT;
+  }
+  p_response[1] = target & 0xff;
+  p_response[2] = target >> 8;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    p_response[3 + i] = values[i];
+  }
+  *p_response_length = COMMAND_QUERY_PAYLOAD;
+
+  return COMMAND_STATUS_OK;
+}
+
+static void command_respond(command_response_t *p_response,
+                            uint8_t opcode,
+                            command_status_t status,
+                            uint8_t length) {
+  uint8_t *p_header = &p_response->data[p_response->length];
+  p_header[0] = opcode;
+  p_header[1] = status;
+  p_header[2] = length;
+  p_response->length += COMMAND_RESPONSE_HEADER + length;
+}
+
+static void command_execute(uint8_t link,
+                            uint8_t opcode,
+                            uint8_t const *p_payload,
+                            uint8_t length,
+                            command_response_t *p_response) {
+  uint8_t *p_data =
+      &p_response->data[p_response->length + COMMAND_RESPONSE_HEADER];
+  uint8_t response_length = 0;
+  command_status_t status;
+
+  trace_record(TRACE_COMMAND, opcode);
+  switch (opcode) {
+    case COMMAND_SET_DUTY:
+      status = command_set_duty(p_payload, length);
+      break;
+    case COMMAND_SET_MODE:
+      status = command_set_mode(p_payload, length);
+      break;
+    case COMMAND_SET_TARGET:
+      status = command_set_target(p_payload, length);
+      break;
+    case COMMAND_SET_BATCH:
+      status = command_set_batch(p_payload, length);
+      break;
+    case COMMAND_SET_DEADBAND:
+      status = command_set_deadband(p_payload, length);
+      break;
+    case COMMAND_SET_HEARTBEAT:
+      status = command_set_heartbeat(p_payload, length);
+      break;
+    case COMMAND_SET_RATE:
+      status = command_set_rate(p_payload, length);
+      break;
+    case COMMAND_SET_STREAM:
+      status = command_set_stream(p_payload, length);
+      break;
+    case COMMAND_CAPTURE_ARM:
+      status = command_capture_arm(p_payload, length);
+      break;
+    case COMMAND_CAPTURE_READ:
+      status = command_capture_read(link, length);
+      break;
+    case COMMAND_SET_LIMITS:
+      status = command_set_limits(p_payload, length);
+      break;
+    case COMMAND_FAULT_QUERY:
+      status = command_fault_query(length, p_data, &response_length);
+      break;
+    case COMMAND_FAULT_CLEAR:
+      status = command_fault_clear(length);
+      break;
+    case COMMAND_SET_FILTER:
+      status = command_set_filter(p_payload, length);
+      break;
+    case COMMAND_SET_REPORT:
+      status = command_set_report(p_payload, length);
+      break;
+    case COMMAND_CAL_POINT:
+      status = command_cal_point(p_payload, length);
+      break;
+    case COMMAND_CAL_APPLY:
+      status = command_cal_apply(p_payload, length);
+      break;
+    case COMMAND_CAL_RESET:
+      status = command_cal_reset(p_payload, length);
+      break;
+    case COMMAND_CAL_QUERY:
+      status =
+          command_cal_query(p_payload, length, p_data, &response_length);
+      break;
+    case COMMAND_SET_CHAIN:
+      status = command_set_chain(p_payload, length);
+      break;
+    case COMMAND_TRACE_START:
+      status = command_trace_start(length);
+      break;
+    case COMMAND_TRACE_READ:
+      status = command_trace_read(link, p_payload, length);
+      break;
+    case COMMAND_SET_POWER:
+      status = command_set_power(p_payload, length);
+      break;
+    case COMMAND_POWER_QUERY:
+      status = command_power_query(length, p_data, &response_length);
+      break;
+    case COMMAND_BOOT_QUERY:
+      status = command_boot_query(length, p_data, &response_length);
+      break;
+    case COMMAND_SET_CURRENT:
+      status = command_set_current(p_payload, length);
+      break;
+    case COMMAND_QUERY:
+      status = command_query(length, p_data, &response_length);
+      break;
+    default:
+      status = COMMAND_STATUS_UNKNOWN_OPCODE;
+      break;
+  }
+
+  if (status != COMMAND_STATUS_OK) {
+    NRF_LOG_WARNING("opcode 0x%02x failed with %i", opcode, status);
+    response_length = 0;
+  }
+
+  command_respond(p_response, opcode, status, response_length);
+}
+
+// runs in the ble event handler, every command is bounded by the write length
+void command_process(uint8_t link, uint8_t const *p_data, uint16_t length) {
+  static command_response_t response;  // kept off the event handler stack
+
+  if (length < 1) {
+    NRF_LOG_WARNING("command without sequence number");
+    return;
+  }
+
+  response.data[0] = p_data[0];  // sequence number
+  response.length = 1;
+
+  // the characteristic takes longer writes, they get an answer too
+  if (COMMAND_MAX_LENGTH < length) {
+    NRF_LOG_WARNING("command invalid length %i", length);
+    uint8_t opcode = (2 <= length) ? p_data[1] : 0;
+    command_respond(&response, opcode, COMMAND_STATUS_INVALID_LENGTH, 0);
+    ble_notify_command_response(link, response.data, response.length);
+    return;
+  }
+  // a smaller MTU on the link splits the responses into more notifications
+  uint16_t max_length =
+      MIN(sizeof(response.data), ble_get_notify_length(BLE_LINK(link)));
+
+  uint16_t position = 1;
+  while (position + 2 <= length) {
+    uint8_t opcode = p_data[position];
+    uint8_t payload_length = p_data[position + 1];
+    position += 2;
+
+    if ((1 < response.length) &&
+        (max_length < response.length + COMMAND_RESPONSE_HEADER +
+                          COMMAND_RESPONSE_PAYLOAD)) {
+      ble_notify_command_response(link, response.data, response.length);
+      response.length = 1;  // the next part repeats the sequence number
+    }
+
+    if (length < position + payload_length) {
+      command_respond(&response, opcode, COMMAND_STATUS_INVALID_LENGTH, 0);
+      break;
+    }
+
+    command_execute(
+        link, opcode, &p_data[position], payload_length, &response);
+    position += payload_length;
+  }
+
+  ble_notify_command_response(link, response.data, response.length);
+}
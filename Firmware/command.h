@@ -0,0 +1,63 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+// write: sequence number, then (opcode, length, payload) per command
+// notify: sequence number, then (opcode, status, length, payload) per command
+// cell and slot masks take CELL_MASK_BYTES and ADC_SLOT_MASK_BYTES
+#define COMMAND_MAX_LENGTH 64
+
+typedef enum {
+  COMMAND_SET_DUTY = 0x01,       // cell mask, duty in percent per cell
+  COMMAND_SET_MODE = 0x02,       // COMMAND_MODE_*
+  COMMAND_SET_TARGET = 0x03,     // termination voltage in mV, uint16
+  COMMAND_QUERY = 0x04,          // returns mode, target and all duty values
+  COMMAND_SET_BATCH = 0x05,      // reporting periods per batch notification
+  COMMAND_SET_DEADBAND = 0x06,   // BLE_DEADBAND_* lane, deadband as uint16
+  COMMAND_SET_HEARTBEAT = 0x07,  // reporting periods between full reports
+  COMMAND_SET_RATE = 0x08,       // SCHEDULE_* task, period in ms as uint16
+  COMMAND_SET_STREAM = 0x09,     // slot mask, decimation
+  COMMAND_CAPTURE_ARM = 0x0A,    // CAPTURE_TRIGGER_*, slot, int16 level, pre
+  COMMAND_CAPTURE_READ = 0x0B,   // download the frozen capture
+  COMMAND_SET_LIMITS = 0x0C,     // voltage in mV, current in mA, uint16 each
+  COMMAND_FAULT_QUERY = 0x0D,    // returns PROTECTION_FAULT_*, cell mask
+  COMMAND_FAULT_CLEAR = 0x0E,    // restarts the balancer PWM
+  COMMAND_SET_FILTER = 0x0F,     // FILTER_LANE_*, process noise in uV or uA
+  COMMAND_SET_REPORT = 0x10,     // COMMAND_REPORT_*
+  COMMAND_CAL_POINT = 0x11,      // lane, cell, point, reference uint16
+  COMMAND_CAL_APPLY = 0x12,      // lane, cell, fits and stores both points
+  COMMAND_CAL_RESET = 0x13,      // lane, cell, back to nominal
+  COMMAND_CAL_QUERY = 0x14,      // lane, cell, returns gain, offset, points
+  COMMAND_SET_CHAIN = 0x15,      // boards, position of this board (0 = head)
+  COMMAND_TRACE_START = 0x16,    // clears the trace and records again
+  COMMAND_TRACE_READ = 0x17,     // target (0 = this link, 1 = log UART)
+  COMMAND_SET_POWER = 0x18,      // policy, monitor interval in ms as uint16
+  COMMAND_POWER_QUERY = 0x19,    // returns mode, sleep, current, block rate
+  COMMAND_BOOT_QUERY = 0x1A,     // returns BOOT_STAGE_* times in us as uint32
+  COMMAND_SET_CURRENT = 0x1B,    // cell mask, target in mA per cell as uint16
+} command_opcode_t;
+
+typedef enum {
+  COMMAND_MODE_MANUAL,
+  COMMAND_MODE_BALANCING,
+  COMMAND_MODE_CURRENT,  // regulates duty to the COMMAND_SET_CURRENT targets
+  COMMAND_MODE_COUNT
+} command_mode_t;
+
+typedef enum {
+  COMMAND_REPORT_AVERAGE,   // average of all blocks since the last report
+  COMMAND_REPORT_FILTERED,  // filter estimate, for short report periods
+  COMMAND_REPORT_COUNT
+} command_report_t;
+
+typedef enum {
+  COMMAND_STATUS_OK,
+  COMMAND_STATUS_UNKNOWN_OPCODE,
+  COMMAND_STATUS_INVALID_LENGTH,
+  COMMAND_STATUS_INVALID_VALUE,
+} command_status_t;
+
+void command_process(uint8_t link, uint8_t const *p_data, uint16_t length);
+
+#endif  // COMMAND_H
@@ -0,0 +1,179 @@
+#include "config.h"
+
+#include "app_util_platform.h"
+#include "ble_gap.h"
+#include "ble_services.h"
+#include "bluetooth.h"
+#include "crc16.h"
+#include "history.h"
+#include "power.h"
+#include "protection.h"
+#include "pwm.h"
+#include "storage.h"
+
+#define NRF_LOG_MODULE_NAME config
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// largest hysteresis and range around the termination voltage
+#define CONFIG_TERM_OFFSET_MAX  500
+
+STATIC_ASSERT(sizeof(config_t) <= STORAGE_MAX_LENGTH,
+              "config does not fit into a storage record");
+STATIC_ASSERT(sizeof(config_t) <= BLE_NOTIFY_MAX_LENGTH,
+              "config has to fit into a single write");
+
+// used until a valid record is stored, the crc is not checked here
+static const config_t config_defaults = {
+    .version = CONFIG_VERSION,
+    .length = sizeof(config_t),
+    .term_voltage = 3600,
+    .term_hysteresis = 10,
+    .term_range = 20,
+    .duty_limit = 75,
+    .voltage_limit = 3800,
+    .current_limit = 400,
+    .periods =
+        {
+            [SCHEDULE_CONTROL] = 1,  // every SAADC block
+            [SCHEDULE_REPORT] = 1000,
+            [SCHEDULE_HISTORY] = 1000,
+            [SCHEDULE_CHAIN] = 250,
+        },
+    .history_1h_interval = 30,    // 120 records of 30 s
+    .history_12h_interval = 360,  // 120 records of 6 min
+    .power_policy = POWER_POLICY_AUTO,
+    .power_interval = 200,
+    .advertising_interval = 64,
+    .advertising_duration = 3000,
+};
+
+// readers use the record in place, in flash as long as it does not move
+static config_t const *volatile p_active = &config_defaults;
+// copy while the flash record moves or its replacement is written
+static config_t shadow;
+// the shadow is applied but not in flash, it stays active if the write fails
+static bool is_unsaved = false;
+
+config_t const *config_get(void) { return p_active; }
+
+static uint16_t config_crc(config_t const *p_config) {
+  return crc16_compute(
+      (uint8_t const *)p_config, offsetof(config_t, crc), NULL);
+}
+
+static bool config_is_valid(config_t const *p_config) {
+  if ((p_config->version != CONFIG_VERSION) ||
+      (p_config->length != sizeof(config_t)) ||
+      (p_config->crc != config_crc(p_config))) {
+    return false;
+  }
+  for (uint8_t task = 0; task < SCHEDULE_TASK_COUNT; task++) {
+    if (!schedule_is_period_valid(task, p_config->periods[task])) {
+      return false;
+    }
+  }
+
+  return pwm_is_target_valid(p_config->term_voltage) &&
+         (p_config->term_hysteresis <= CONFIG_TERM_OFFSET_MAX) &&
+         (p_config->term_range <= CONFIG_TERM_OFFSET_MAX) &&
+         (p_config->duty_limit <= PWM_TOP_VALUE) &&
+         protection_are_limits_valid(p_config->voltage_limit,
+                                     p_config->current_limit) &&
+         history_are_intervals_valid(p_config->history_1h_interval,
+                                     p_config->history_12h_interval) &&
+         power_is_policy_valid(p_config->power_policy,
+                               p_config->power_interval) &&
+         (BLE_GAP_ADV_INTERVAL_MIN <= p_config->advertising_interval);
+}
+
+// a single pointer store, readers see the old or the new record as a whole
+static void config_activate_copy(config_t const *p_config) {
+  CRITICAL_REGION_ENTER();
+  memcpy(&shadow, p_config, sizeof(shadow));
+  p_active = &shadow;
+  CRITICAL_REGION_EXIT();
+}
+
+static void config_map(void) {
+  config_t const *p_stored =
+      storage_map(STORAGE_KEY_CONFIG, sizeof(config_t));
+  if ((p_stored != NULL) && config_is_valid(p_stored)) {
+    p_active = p_stored;
+  }
+}
+
+// pwm, history and the schedule read the config when they need a value,
+// everything else keeps its own copy that commands may change until reset
+static void config_apply(config_t const *p_config) {
+  pwm_set_target(p_config->term_voltage);
+  protection_set_limits(p_config->voltage_limit, p_config->current_limit);
+  power_set_policy(p_config->power_policy, p_config->power_interval);
+  ble_advertising_update();
+}
+
+static void config_storage_handler(uint8_t event, uint16_t key) {
+  switch (event) {
+    case STORAGE_EVT_GC_START:
+      if ((p_active != &shadow) && (p_active != &config_defaults)) {
+        config_activate_copy(p_active);
+      }
+      break;
+    case STORAGE_EVT_GC_DONE:
+      if (!is_unsaved) {
+        config_map();
+      }
+      break;
+    case STORAGE_EVT_STORED:
+      if (key == STORAGE_KEY_CONFIG) {
+        is_unsaved = false;
+        config_map();
+      }
+      break;
+    case STORAGE_EVT_FAILED:
+      if (key == STORAGE_KEY_CONFIG) {
+        NRF_LOG_WARNING("config not stored, active until reset");
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// a complete record, validated before anything changes
+void config_write(uint8_t const *p_data, uint16_t length) {
+  config_t config;
+
+  if (length != sizeof(config)) {
+    NRF_LOG_WARNING("config invalid length %i", length);
+    ble_update_config_value(p_active);
+    return;
+  }
+  memcpy(&config, p_data, sizeof(config));
+  if (!config_is_valid(&config) ||
+      !storage_write(STORAGE_KEY_CONFIG, &config, sizeof(config))) {
+    NRF_LOG_WARNING("config rejected");
+    ble_update_config_value(p_active);
+    return;
+  }
+
+  is_unsaved = true;
+  config_activate_copy(&config);
+  config_apply(p_active);
+  for (uint8_t task = 0; task < SCHEDULE_TASK_COUNT; task++) {
+    schedule_set_period(task, p_active->periods[task]);
+  }
+  ble_update_config_value(p_active);
+  NRF_LOG_INFO("config committed");
+}
+
+// requires storage_init() and ble_init(), before schedule_init()
+void config_init(void) {
+  storage_set_handler(config_storage_handler);
+
+  config_map();
+  bool is_stored = (p_active != &config_defaults);
+  NRF_LOG_INFO("%s config", is_stored ? "stored" : "default");
+  config_apply(p_active);
+  ble_update_config_value(p_active);
+}
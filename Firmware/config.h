@@ -0,0 +1,43 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "schedule.h"
+
+// bump on any layout change, older records fall back to the defaults
+#define CONFIG_VERSION 1
+
+// little endian as stored in flash and on the config characteristic,
+// keep in sync with Host-App
+typedef struct {
+  uint16_t version;
+  uint16_t length;  // sizeof(config_t)
+  // balancing, see pwm.c
+  uint16_t term_voltage;     // termination voltage after boot in mV
+  uint16_t term_hysteresis;  // mV around the termination voltage
+  uint16_t term_range;       // mV above the lowest cell
+  uint16_t duty_limit;       // of PWM_TOP_VALUE
+  // protection
+  uint16_t voltage_limit;  // mV
+  uint16_t current_limit;  // mA
+  // task periods in ms, see SET_RATE
+  uint16_t periods[SCHEDULE_TASK_COUNT];
+  // history aggregation in history task periods
+  uint16_t history_1h_interval;
+  uint16_t history_12h_interval;  // multiple of the 1h interval
+  // acquisition, see power.h
+  uint16_t power_policy;
+  uint16_t power_interval;  // ms
+  // advertising, taken over on its next start
+  uint16_t advertising_interval;  // in 0.625 ms units
+  uint16_t advertising_duration;  // in 10 ms units
+  uint16_t crc;                   // crc16 over everything above
+} config_t;
+
+void config_init(void);
+config_t const *config_get(void);
+void config_write(uint8_t const *p_data, uint16_t length);
+
+#endif  // CONFIG_H
@@ -1,6 +1,8 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include <stdint.h>
+
 #include "nrf_gpio.h"
 #include "nrf_saadc.h"
 
@@ -36,7 +38,52 @@
 // also set NRF_LOG_BACKEND_UART_TX_PIN!
 #define UART_TX_PIN   NRF_GPIO_PIN_MAP(1, 13)
 
+// daisy chain to the neighbouring boards, see chain.h
+#define CHAIN_TX_PIN  NRF_GPIO_PIN_MAP(1, 10)
+#define CHAIN_RX_PIN  NRF_GPIO_PIN_MAP(1, 11)
+
 #define TP1_PIN       NRF_GPIO_PIN_MAP(0, 11)
 #define TP2_PIN       NRF_GPIO_PIN_MAP(0, 14)
 
+// pack topology, cell counts, buffers and characteristics are sized from here
+
+#define BOARD_CELL_COUNT        8
+
+// muxes share the select lines, every mux output is one SAADC channel
+#define BOARD_ADC_CHANNEL_COUNT 2
+#define BOARD_ADC_CHANNELS(X) \
+  X(LOWER_MUX_ADC, 0)         \
+  X(UPPER_MUX_ADC, 1)
+
+// select pins from S0 upwards, at most 4, driven by one PWM instance
+#define BOARD_MUX_SELECT_COUNT  3
+#define BOARD_MUX_SELECT_PINS   {MUX_S0, MUX_S1, MUX_S2}
+
+// select value of every mux step in scan order, one SAADC sample per channel
+#define BOARD_MUX_STEP_COUNT    8
+#define BOARD_MUX_STEPS         {4, 3, 0, 1, 2, 5, 6, 7}
+
+// buffer slot of a mux step on a SAADC channel
+#define BOARD_SLOT(_step, _channel) \
+  ((_step) * BOARD_ADC_CHANNEL_COUNT + (_channel))
+
+typedef struct {
+  uint8_t voltage_slot;
+  uint8_t current_slot;
+  uint32_t balancer_pin;  // cells are assigned to PWM instances in groups of 4
+} board_cell_t;
+
+// from the lowest cell of the stack upwards
+#define BOARD_CELLS                                    \
+  {                                                    \
+    {BOARD_SLOT(0, 0), BOARD_SLOT(4, 0), BAL1_PIN},    \
+    {BOARD_SLOT(1, 0), BOARD_SLOT(6, 0), BAL2_PIN},    \
+    {BOARD_SLOT(2, 0), BOARD_SLOT(5, 0), BAL3_PIN},    \
+    {BOARD_SLOT(3, 0), BOARD_SLOT(7, 0), BAL4_PIN},    \
+    {BOARD_SLOT(4, 1), BOARD_SLOT(0, 1), BAL5_PIN},    \
+    {BOARD_SLOT(6, 1), BOARD_SLOT(1, 1), BAL6_PIN},    \
+    {BOARD_SLOT(5, 1), BOARD_SLOT(2, 1), BAL7_PIN},    \
+    {BOARD_SLOT(7, 1), BOARD_SLOT(3, 1), BAL8_PIN},    \
+  }
+
 #endif  // BOARD_H
@@ -15,6 +15,8 @@
 // PWM0/1: balancer
 // PWM2: multiplexer
 // TIMER1: ADC
+// TIMER2: boot stage times, stopped after the boot
+// TIMER3: trace timestamps, runs only while recording
 
 // Interrupt priorities reserved for SoftDevice
 // Level 0: timing critical processing
@@ -64,12 +66,12 @@
 
 // SoftDevice BLE event handler configuration
 #define NRF_SDH_BLE_ENABLED                                   1
-#define NRF_SDH_BLE_GAP_DATA_LENGTH                           27
-#define NRF_SDH_BLE_PERIPHERAL_LINK_COUNT                     1
+#define NRF_SDH_BLE_GAP_DATA_LENGTH                           251
+#define NRF_SDH_BLE_PERIPHERAL_LINK_COUNT                     3
 #define NRF_SDH_BLE_CENTRAL_LINK_COUNT                        0
-#define NRF_SDH_BLE_TOTAL_LINK_COUNT                          1
-#define NRF_SDH_BLE_GAP_EVENT_LENGTH                          6
-#define NRF_SDH_BLE_GATT_MAX_MTU_SIZE                         (192 + 3)  // max 247
+#define NRF_SDH_BLE_TOTAL_LINK_COUNT                          3
+#define NRF_SDH_BLE_GAP_EVENT_LENGTH                          12
+#define NRF_SDH_BLE_GATT_MAX_MTU_SIZE                         247
 #define NRF_SDH_BLE_GATTS_ATTR_TAB_SIZE                       1408
 #define NRF_SDH_BLE_VS_UUID_COUNT                             10
 #define NRF_SDH_BLE_SERVICE_CHANGED                           0
@@ -139,7 +141,7 @@
 #define APP_TIMER_CONFIG_IRQ_PRIORITY                         APP_IRQ_PRIORITY_LOW
 #define APP_TIMER_CONFIG_OP_QUEUE_SIZE                        10
 #define APP_TIMER_CONFIG_USE_SCHEDULER                        0
-#define APP_TIMER_KEEPS_RTC_ACTIVE                            0
+#define APP_TIMER_KEEPS_RTC_ACTIVE                            1
 #define APP_TIMER_SAFE_WINDOW_MS                              300000
 #define APP_TIMER_WITH_PROFILER                               0
 #define APP_TIMER_CONFIG_SWI_NUMBER                           0
@@ -161,6 +163,27 @@
 #define NRF_PWR_MGMT_CONFIG_USE_SCHEDULER                     0
 #define NRF_PWR_MGMT_CONFIG_HANDLER_PRIORITY_COUNT            3
 
+// Flash data storage configuration
+#define FDS_ENABLED                                           1
+#define FDS_VIRTUAL_PAGES                                     3
+#define FDS_VIRTUAL_PAGE_SIZE                                 1024
+#define FDS_VIRTUAL_PAGES_RESERVED                            0
+#define FDS_BACKEND                                           2  // SoftDevice
+#define FDS_OP_QUEUE_SIZE                                     4
+#define FDS_CRC_CHECK_ON_READ                                 1
+#define FDS_CRC_CHECK_ON_WRITE                                0
+#define FDS_MAX_USERS                                         4
+
+// Flash storage configuration, accessed through the SoftDevice
+#define NRF_FSTORAGE_ENABLED                                  1
+#define NRF_FSTORAGE_PARAM_CHECK_DISABLED                     0
+#define NRF_FSTORAGE_SD_QUEUE_SIZE                            4
+#define NRF_FSTORAGE_SD_MAX_RETRIES                           8
+#define NRF_FSTORAGE_SD_MAX_WRITE_SIZE                        4096
+
+// CRC16 configuration
+#define CRC16_ENABLED                                         1
+
 // Section iterator configuration
 #define NRF_SECTION_ITER_ENABLED                              1
 
@@ -185,8 +208,13 @@
 #define NRF_LOG_WARNING_COLOR                                 4
 #define NRF_LOG_TIMESTAMP_DEFAULT_FREQUENCY                   0
 
-// Log UART backend configuration
-#define NRF_LOG_BACKEND_UART_ENABLED                          1
+// Log UART backend configuration, pin and baudrate are shared by the binary
+// backend (log_binary.h) which replaces the text backend when enabled, off
+// unless built with make LOG_BINARY=1
+#ifndef LOG_BACKEND_BINARY_ENABLED
+#define LOG_BACKEND_BINARY_ENABLED                            0
+#endif
+#define NRF_LOG_BACKEND_UART_ENABLED                          (!LOG_BACKEND_BINARY_ENABLED)
 #define NRF_LOG_BACKEND_UART_TX_PIN                           (32 + 13)
 // #define NRF_LOG_BACKEND_UART_BAUDRATE                  30801920
 #define NRF_LOG_BACKEND_UART_BAUDRATE                         2576384
@@ -203,8 +231,8 @@
 #define UART_LEGACY_SUPPORT                                   1
 #define UART0_ENABLED                                         1
 #define UART0_CONFIG_USE_EASY_DMA                             1
-#define UART1_ENABLED                                         0
-#define UART1_CONFIG_USE_EASY_DMA                             0
+#define UART1_ENABLED                                         1
+#define UART1_CONFIG_USE_EASY_DMA                             1
 
 // Peripheral Resource Sharing module configuration
 #define NRFX_PRS_ENABLED                                      1
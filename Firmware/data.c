@@ -2,20 +2,33 @@
 
 #include "adc.h"
 #include "ble_services.h"
+#include "boot.h"
+#include "calibration.h"
+#include "filter.h"
 #include "history.h"
+#include "power.h"
+#include "protection.h"
 #include "pwm.h"
+#include "summary.h"
+#include "timestamp.h"
 
 #define NRF_LOG_MODULE_NAME data
 #include "log.h"
 NRF_LOG_MODULE_REGISTER();
 
-#define ADC_RESOLUTON_BITS (8 + (2 * ADC_RESOLUTON))  // nrf enum magic numbers
-#define ADC_RANGE          (1 << ADC_RESOLUTON_BITS)
+#define NUMBER_OF_SAMPLES_SHIFT 3
+#define NUMBER_OF_SAMPLES       (1 << NUMBER_OF_SAMPLES_SHIFT)
 
-#define NUMBER_OF_SAMPLES  8  // danger of type overflow
+// cells per log entry are limited by the arguments of NRF_LOG, two cells
+// share one argument
+#define DATA_LOG_ENTRY_CELLS    8
+#define DATA_LOG_ENTRIES \
+  ((NUMBER_OF_CELLS + DATA_LOG_ENTRY_CELLS - 1) / DATA_LOG_ENTRY_CELLS)
+#define DATA_LOG_CELLS          (DATA_LOG_ENTRIES * DATA_LOG_ENTRY_CELLS)
 
 typedef struct {
   nrf_saadc_value_t raw_values[NUMBER_OF_SAMPLES];
+  int32_t raw_sum;
   // in millivolt/milliampere
   uint16_t avg_value_millis;
   uint16_t deviation_millis;
@@ -31,171 +44,249 @@ typedef struct {
   uint32_t current[NUMBER_OF_CELLS];
   uint32_t volt_dev[NUMBER_OF_CELLS];
   uint32_t curr_dev[NUMBER_OF_CELLS];
+  uint32_t duty[NUMBER_OF_CELLS];
   uint16_t length;
 } ble_values_t;
 
-static ble_values_t ble_values;
+// accumulated between two reports and two history entries respectively
+static ble_values_t report_values;
+static ble_values_t history_values;
+
+// unfiltered block averages, the current mode regulates on these
+static uint16_t latest_currents[NUMBER_OF_CELLS];
+// report filter estimates instead of the average since the last report
+static bool is_fast_report = false;
+
+static const board_cell_t board_cells[NUMBER_OF_CELLS] = BOARD_CELLS;
 
 static void data_deinterlace_buffer(cell_t cells[],
                                     nrf_saadc_value_t *p_buffer) {
   nrf_saadc_value_t *p_current_samples;
 
-  const uint8_t voltage_sequence[] = {0, 2, 4, 6, 9, 13, 11, 15};
-  const uint8_t current_sequence[] = {8, 12, 10, 14, 1, 3, 5, 7};
-
   for (size_t i = 0; i < NUMBER_OF_SAMPLES; i++) {
-    p_current_samples = &p_buffer[i * NUMBER_OF_CELLS * 2];
+    p_current_samples = &p_buffer[i * ADC_SLOT_COUNT];
     for (size_t k = 0; k < NUMBER_OF_CELLS; k++) {
-      cells[k].voltage.raw_values[i] = p_current_samples[voltage_sequence[k]];
-      cells[k].current.raw_values[i] = p_current_samples[current_sequence[k]];
+      cells[k].voltage.raw_values[i] =
+          p_current_samples[board_cells[k].voltage_slot];
+      cells[k].current.raw_values[i] =
+          p_current_samples[board_cells[k].current_slot];
     }
   }
 }
 
-static uint16_t data_raw_to_voltage(uint16_t raw) {
-  uint32_t val = raw * 825 * 267 / (47 * ADC_RANGE);
-  return (uint16_t)val;
-}
-
-static uint16_t data_raw_to_current(uint16_t raw) {
-  uint32_t val = raw * 825 * 62 / (47 * ADC_RANGE);
-  return (uint16_t)val;
+static uint16_t data_clamp_millis(int32_t millis) {
+  return (uint16_t)MIN(MAX(millis, 0), UINT16_MAX);
 }
 
-static void data_aggregate_voltage(cell_t cells[]) {
-  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-    int16_t temp_min = ADC_RANGE;
-    int16_t temp_max = 0;
-    int32_t temp_sum = 0;
-    for (size_t k = 0; k < NUMBER_OF_SAMPLES; k++) {
-      int16_t val = cells[i].voltage.raw_values[k];
-      temp_sum += val;
-      if (temp_max < val) {
-        temp_max = val;
-      } else if (val < temp_min) {
-        temp_min = val;
-      }
+static void data_aggregate(cell_values_t *p_values,
+                           uint8_t lane,
+                           uint8_t cell) {
+  int16_t temp_min = ADC_RANGE;
+  int16_t temp_max = 0;
+  int32_t temp_sum = 0;
+  for (size_t k = 0; k < NUMBER_OF_SAMPLES; k++) {
+    int16_t val = p_values->raw_values[k];
+    temp_sum += val;
+    if (temp_max < val) {
+      temp_max = val;
+    }
+    if (val < temp_min) {
+      temp_min = val;
     }
-    temp_sum = temp_sum < 0 ? 0 : temp_sum;
-    cells[i].voltage.avg_value_millis =
-        data_raw_to_voltage(temp_sum / NUMBER_OF_SAMPLES);
-    cells[i].voltage.deviation_millis =
-        data_raw_to_voltage(temp_max - temp_min);
   }
+  temp_sum = temp_sum < 0 ? 0 : temp_sum;
+  p_values->raw_sum = temp_sum;
+
+  p_values->avg_value_millis = data_clamp_millis(
+      calibration_to_millis(lane, cell, temp_sum, NUMBER_OF_SAMPLES_SHIFT));
+  p_values->deviation_millis = data_clamp_millis(
+      calibration_scale(lane, cell, temp_max - temp_min));
 }
 
-static void data_aggregate_current(cell_t cells[]) {
+static void data_aggregate_cells(cell_t cells[]) {
   for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-    int16_t temp_min = ADC_RANGE;
-    int16_t temp_max = 0;
-    int32_t temp_sum = 0;
-    for (size_t k = 0; k < NUMBER_OF_SAMPLES; k++) {
-      int16_t val = cells[i].current.raw_values[k];
-      temp_sum += val;
-      if (temp_max < val) {
-        temp_max = val;
-      } else if (val < temp_min) {
-        temp_min = val;
-      }
-    }
-    temp_sum = temp_sum < 0 ? 0 : temp_sum;
-    cells[i].current.avg_value_millis =
-        data_raw_to_current(temp_sum / NUMBER_OF_SAMPLES);
-    cells[i].current.deviation_millis =
-        data_raw_to_current(temp_max - temp_min);
+    data_aggregate(&cells[i].voltage, CALIBRATION_LANE_VOLTAGE, i);
+    data_aggregate(&cells[i].current, CALIBRATION_LANE_CURRENT, i);
   }
 }
 
-static void data_add_values_to_ble_struct(cell_t cells[]) {
+static void data_add_values_to_ble_struct(ble_values_t *p_values,
+                                          cell_t cells[],
+                                          uint16_t duty[]) {
+  // saturate instead of wrapping when a scheduled task falls far behind
+  if (p_values->length == UINT16_MAX) {
+    return;
+  }
+
   for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-    ble_values.voltage[i] += cells[i].voltage.avg_value_millis;
-    ble_values.current[i] += cells[i].current.avg_value_millis;
+    p_values->voltage[i] += cells[i].voltage.avg_value_millis;
+    p_values->current[i] += cells[i].current.avg_value_millis;
+    p_values->duty[i] += duty[i];
 
-    if (ble_values.volt_dev[i] < cells[i].voltage.deviation_millis) {
-      ble_values.volt_dev[i] = cells[i].voltage.deviation_millis;
+    if (p_values->volt_dev[i] < cells[i].voltage.deviation_millis) {
+      p_values->volt_dev[i] = cells[i].voltage.deviation_millis;
     }
 
-    if (ble_values.curr_dev[i] < cells[i].current.deviation_millis) {
-      ble_values.curr_dev[i] = cells[i].current.deviation_millis;
+    if (p_values->curr_dev[i] < cells[i].current.deviation_millis) {
+      p_values->curr_dev[i] = cells[i].current.deviation_millis;
     }
   }
-  ble_values.length += 1;
+  p_values->length += 1;
+}
+
+static void data_prepare_ble_transmission(ble_values_t *p_values) {
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    p_values->voltage[i] /= p_values->length;
+    p_values->current[i] /= p_values->length;
+    p_values->duty[i] /= p_values->length;
+  }
+}
+
+static void data_fill_records(ble_values_t const *p_values,
+                              data_record_t *p_val_record,
+                              data_record_t *p_dev_record,
+                              uint64_t uptime) {
+  p_val_record->timestamp = timestamp_to_unix(uptime);
+  p_dev_record->timestamp = p_val_record->timestamp;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    p_val_record->values[(2 * i)] = (uint16_t)p_values->voltage[i];
+    p_val_record->values[(2 * i) + 1] = (uint16_t)p_values->current[i];
+    p_dev_record->values[(2 * i)] = (uint16_t)p_values->volt_dev[i];
+    p_dev_record->values[(2 * i) + 1] = (uint16_t)p_values->curr_dev[i];
+  }
 }
 
-static void data_prepare_ble_transmission() {
+// raw arguments only, the backend formats (text) or not at all (binary),
+// one entry per lane of up to 8 cells keeps the deferred buffer small, each
+// argument holds two cells as uint16, the lower cell in the low half
+static void data_log_lane(char const *p_lane, uint32_t const values[]) {
+  uint32_t packed[DATA_LOG_CELLS / 2] = {0};
   for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-    ble_values.voltage[i] /= ble_values.length;
-    ble_values.current[i] /= ble_values.length;
+    packed[i / 2] |= MIN(values[i], UINT16_MAX) << (16 * (i % 2));
+  }
+
+  for (size_t i = 0; i < DATA_LOG_CELLS / 2; i += DATA_LOG_ENTRY_CELLS / 2) {
+    NRF_LOG_INFO("%s: %08x %08x %08x %08x",
+                 p_lane,
+                 packed[i],
+                 packed[i + 1],
+                 packed[i + 2],
+                 packed[i + 3]);
   }
 }
 
-static void data_log_values() {
-  static char voltage_string[47] = {};  // static for logger
-  snprintf(voltage_string,
-           sizeof(voltage_string),
-           "%4lu,%4lu,%4lu,%4lu,%4lu,%4lu,%4lu,%4lu",
-           ble_values.voltage[0],
-           ble_values.voltage[1],
-           ble_values.voltage[2],
-           ble_values.voltage[3],
-           ble_values.voltage[4],
-           ble_values.voltage[5],
-           ble_values.voltage[6],
-           ble_values.voltage[7]);
-  NRF_LOG_INFO("%s", voltage_string);
-
-  static char current_string[47] = {};  // static for logger
-  snprintf(current_string,
-           sizeof(current_string),
-           "%4lu,%4lu,%4lu,%4lu,%4lu,%4lu,%4lu,%4lu",
-           ble_values.current[0],
-           ble_values.current[1],
-           ble_values.current[2],
-           ble_values.current[3],
-           ble_values.current[4],
-           ble_values.current[5],
-           ble_values.current[6],
-           ble_values.current[7]);
-  NRF_LOG_INFO("%s", current_string);
+static void data_log_values(ble_values_t const *p_values) {
+  data_log_lane("voltage", p_values->voltage);
+  data_log_lane("current", p_values->current);
 }
 
 void data_process_buffer(nrf_saadc_value_t *p_buffer) {
   cell_t cells[NUMBER_OF_CELLS];
-  static uint16_t seconds_counter = 0;
 
   data_deinterlace_buffer(cells, p_buffer);
-  data_aggregate_voltage(cells);
-  data_aggregate_current(cells);
-
-  uint16_t cell_voltages[NUMBER_OF_CELLS];
+  data_aggregate_cells(cells);
+
+  uint16_t voltages[NUMBER_OF_CELLS];
+  uint16_t currents[NUMBER_OF_CELLS];
+  uint16_t voltage_ranges[NUMBER_OF_CELLS];
+  uint16_t current_ranges[NUMBER_OF_CELLS];
+  int32_t voltage_sums[NUMBER_OF_CELLS];
+  int32_t current_sums[NUMBER_OF_CELLS];
   for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-    cell_voltages[i] = cells[i].voltage.avg_value_millis;
+    voltage_sums[i] = cells[i].voltage.raw_sum;
+    current_sums[i] = cells[i].current.raw_sum;
+    voltages[i] = cells[i].voltage.avg_value_millis;
+    currents[i] = cells[i].current.avg_value_millis;
+    voltage_ranges[i] = cells[i].voltage.deviation_millis;
+    current_ranges[i] = cells[i].current.deviation_millis;
   }
-  pwm_calculate_next_values(cell_voltages);
+  protection_check(voltages, currents);  // unfiltered, reacts on this block
+  boot_stage(BOOT_STAGE_MEASUREMENT);
+  power_check(voltages, currents);
+  filter_update(FILTER_LANE_VOLTAGE, voltages, voltage_ranges);
+  filter_update(FILTER_LANE_CURRENT, currents, current_ranges);
+  uint16_t estimates[NUMBER_OF_CELLS];
+  filter_get_estimates(FILTER_LANE_VOLTAGE, estimates);
+  summary_update(estimates);
+  calibration_measure(voltage_sums, current_sums);
+  memcpy(latest_currents, currents, sizeof(latest_currents));
+
+  uint16_t duty[NUMBER_OF_CELLS];
+  pwm_get_values(duty);
+  data_add_values_to_ble_struct(&report_values, cells, duty);
+  data_add_values_to_ble_struct(&history_values, cells, duty);
+}
 
-  data_add_values_to_ble_struct(cells);
+// runs after a new block reached the filter, see schedule_block_done()
+void data_control(void) {
+  uint16_t voltages[NUMBER_OF_CELLS];
+  filter_get_estimates(FILTER_LANE_VOLTAGE, voltages);
+  pwm_calculate_next_values(voltages);
+  pwm_regulate_currents(latest_currents, voltages);
+}
 
-  if (1000 <= ble_values.length) {
-    seconds_counter++;  // overflow is not handled!!
+void data_set_fast_report(bool is_enabled) {
+  is_fast_report = is_enabled;
+  NRF_LOG_INFO("fast report %s", is_enabled ? "enabled" : "disabled");
+}
 
-    data_prepare_ble_transmission();
+static void data_use_estimates(ble_values_t *p_values) {
+  uint16_t voltages[NUMBER_OF_CELLS];
+  uint16_t currents[NUMBER_OF_CELLS];
+  filter_get_estimates(FILTER_LANE_VOLTAGE, voltages);
+  filter_get_estimates(FILTER_LANE_CURRENT, currents);
 
-    static uint16_t val_buffer[(sizeof(uint16_t) * NUMBER_OF_CELLS)] = {0};
-    static uint16_t dev_buffer[(sizeof(uint16_t) * NUMBER_OF_CELLS)] = {0};
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    p_values->voltage[i] = voltages[i];
+    p_values->current[i] = currents[i];
+  }
+}
 
-    data_log_values();
+void data_report(void) {
+  static data_record_t val_record = {0};
+  static data_record_t dev_record = {0};
 
-    for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-      val_buffer[(2 * i)] = (uint16_t)ble_values.voltage[i];
-      val_buffer[(2 * i) + 1] = (uint16_t)ble_values.current[i];
-      dev_buffer[(2 * i)] = (uint16_t)ble_values.volt_dev[i];
-      dev_buffer[(2 * i) + 1] = (uint16_t)ble_values.curr_dev[i];
-    }
+  if (report_values.length == 0) {
+    return;
+  }
 
-    history_fill_buffer(val_buffer, seconds_counter);
+  data_prepare_ble_transmission(&report_values);
+  if (is_fast_report) {
+    data_use_estimates(&report_values);
+  }
+  data_log_values(&report_values);
+  uint64_t uptime = timestamp_get_uptime();
+  data_fill_records(&report_values, &val_record, &dev_record, uptime);
+
+  ble_notify_cell_values(&val_record, VALUES);
+  ble_notify_cell_values(&dev_record, DEVIATIONS);
+  ble_notify_batch(&val_record, &dev_record);
+  ble_notify_changes(&val_record, &dev_record);
+  ble_broadcast_update(&val_record,
+                       pwm_is_balancer_active() || pwm_is_current_active());
+  ble_update_time_value(val_record.timestamp);
+  summary_report(uptime);
+  memset(&report_values, 0, sizeof(report_values));
+}
 
-    ble_notify_cell_values(val_buffer, VALUES);
-    ble_notify_cell_values(dev_buffer, DEVIATIONS);
-    memset(&ble_values, 0, sizeof(ble_values));
+void data_record_history(void) {
+  static uint32_t history_counter = 0;
+  data_record_t val_record;
+  data_record_t dev_record;
+  uint16_t duty[NUMBER_OF_CELLS];
+
+  if (history_values.length == 0) {
+    return;
   }
-}
\ No newline at end of file
+  history_counter++;
+  uint64_t uptime = timestamp_get_uptime();
+
+  data_prepare_ble_transmission(&history_values);
+  data_fill_records(&history_values, &val_record, &dev_record, uptime);
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    duty[i] = (uint16_t)history_values.duty[i];
+  }
+
+  history_fill_buffer(&val_record, &dev_record, duty, history_counter, uptime);
+  memset(&history_values, 0, sizeof(history_values));
+}
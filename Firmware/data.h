@@ -1,10 +1,33 @@
 #ifndef DATA_H
 #define DATA_H
 
+#include <stdbool.h>
+
+#include "board.h"
 #include "nrf_saadc.h"
 
-#define NUMBER_OF_CELLS 8
+#define NUMBER_OF_CELLS BOARD_CELL_COUNT
+
+// one bit per cell, sent as CELL_MASK_BYTES little endian bytes
+#if NUMBER_OF_CELLS <= 8
+typedef uint8_t cell_mask_t;
+#elif NUMBER_OF_CELLS <= 16
+typedef uint16_t cell_mask_t;
+#else
+typedef uint32_t cell_mask_t;
+#endif
+#define CELL_MASK_BYTES ((NUMBER_OF_CELLS + 7) / 8)
+
+// sequence: voltage 1, current 1, voltage 2, ...
+typedef struct {
+  uint64_t timestamp;  // in milliseconds, see timestamp.h
+  uint16_t values[2 * NUMBER_OF_CELLS];
+} data_record_t;
 
 void data_process_buffer(nrf_saadc_value_t *p_buffer);
+void data_control(void);
+void data_set_fast_report(bool is_enabled);
+void data_report(void);
+void data_record_history(void);
 
 #endif  // DATA_H
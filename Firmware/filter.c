@@ -0,0 +1,81 @@
+#include "filter.h"
+
+#define NRF_LOG_MODULE_NAME filter
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// process noise is the expected drift per block in micro units (uV, uA),
+// it trades noise for lag: on a simulated 2 mV noise cell 100 gives 0.16 mV
+// and 23 blocks to 90% of a step, 20 gives 0.07 mV and 117 blocks, the 1 s
+// boxcar report 0.02 mV and 999 blocks (Host-App/filter_replay.py)
+#define FILTER_PROCESS_NOISE_DEFAULT 20
+#define FILTER_VARIANCE(_noise) \
+  (((_noise) / 1000.0f) * ((_noise) / 1000.0f))
+// the range of 8 gaussian samples is about 3 sigma
+#define FILTER_RANGE_SIGMAS          3.0f
+#define FILTER_BLOCK_SAMPLES         8.0f
+// floor of one mV^2 or mA^2, covers quantization of both lanes
+#define FILTER_MEASUREMENT_NOISE_MIN 1.0f
+
+// first order kalman filter per cell, the state is the true value and the
+// block average is the measurement, its noise is taken from the block range
+typedef struct {
+  float estimate;
+  float variance;
+} filter_state_t;
+
+typedef struct {
+  filter_state_t states[NUMBER_OF_CELLS];
+  float process_noise;  // variance per block
+  bool is_initialized;
+} filter_lane_state_t;
+
+static filter_lane_state_t lanes[FILTER_LANE_COUNT] = {
+    [0 ... FILTER_LANE_COUNT - 1] = {
+        .process_noise = FILTER_VARIANCE(FILTER_PROCESS_NOISE_DEFAULT)}};
+
+static float filter_measurement_noise(uint16_t range) {
+  float sigma = range / FILTER_RANGE_SIGMAS;
+  float variance = sigma * sigma / FILTER_BLOCK_SAMPLES;
+  return MAX(variance, FILTER_MEASUREMENT_NOISE_MIN);
+}
+
+void filter_update(uint8_t lane,
+                   uint16_t const averages[NUMBER_OF_CELLS],
+                   uint16_t const ranges[NUMBER_OF_CELLS]) {
+  filter_lane_state_t *p_lane = &lanes[lane];
+
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    filter_state_t *p_state = &p_lane->states[i];
+    float measurement_noise = filter_measurement_noise(ranges[i]);
+
+    if (!p_lane->is_initialized) {
+      p_state->estimate = averages[i];
+      p_state->variance = measurement_noise;
+      continue;
+    }
+
+    float variance = p_state->variance + p_lane->process_noise;
+    float gain = variance / (variance + measurement_noise);
+    p_state->estimate += gain * (averages[i] - p_state->estimate);
+    p_state->variance = (1.0f - gain) * variance;
+  }
+  p_lane->is_initialized = true;
+}
+
+void filter_get_estimates(uint8_t lane, uint16_t estimates[NUMBER_OF_CELLS]) {
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    float estimate = lanes[lane].states[i].estimate + 0.5f;
+    estimates[i] = (uint16_t)MIN(MAX(estimate, 0.0f), (float)UINT16_MAX);
+  }
+}
+
+bool filter_set_process_noise(uint8_t lane, uint16_t noise) {
+  if (FILTER_LANE_COUNT <= lane || noise == 0) {
+    return false;
+  }
+  lanes[lane].process_noise = FILTER_VARIANCE(noise);
+  NRF_LOG_INFO("lane %i process noise %i", lane, noise);
+
+  return true;
+}
@@ -0,0 +1,22 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data.h"
+
+typedef enum {
+  FILTER_LANE_VOLTAGE,  // mV
+  FILTER_LANE_CURRENT,  // mA
+  FILTER_LANE_COUNT
+} filter_lane_t;
+
+// one step per SAADC block, ranges are the max-min spread of the block
+void filter_update(uint8_t lane,
+                   uint16_t const averages[NUMBER_OF_CELLS],
+                   uint16_t const ranges[NUMBER_OF_CELLS]);
+void filter_get_estimates(uint8_t lane, uint16_t estimates[NUMBER_OF_CELLS]);
+bool filter_set_process_noise(uint8_t lane, uint16_t noise);
+
+#endif  // FILTER_H
@@ -1,108 +1,280 @@
 #include "history.h"
 
+#include "ble_queue.h"
 #include "ble_services.h"
+#include "config.h"
 #include "data.h"
+#include "summary.h"
+#include "timestamp.h"
 
 #define HISTORY_BUFFER_ELEMENTS 120
-#define HISTORY_1H_INTERVAL     30
-#define HISTORY_12H_INTERVAL    360
-#define HISTORY_12H_1H_INTERVAL (HISTORY_12H_INTERVAL / HISTORY_1H_INTERVAL)
 
 #define NRF_LOG_MODULE_NAME     history
 #include "log.h"
 NRF_LOG_MODULE_REGISTER();
 
-static uint16_t history_2min_buffer[HISTORY_BUFFER_ELEMENTS][16] = {
-    [0 ... HISTORY_BUFFER_ELEMENTS - 1] = {[0 ... 15] = 0xffff}};
-static uint16_t history_1h_buffer[HISTORY_BUFFER_ELEMENTS][16] = {
-    [0 ... HISTORY_BUFFER_ELEMENTS - 1] = {[0 ... 15] = 0xffff}};
-static uint16_t history_12h_buffer[HISTORY_BUFFER_ELEMENTS][16] = {
-    [0 ... HISTORY_BUFFER_ELEMENTS - 1] = {[0 ... 15] = 0xffff}};
+// empty records are marked by all bits set
+#define HISTORY_EMPTY_RECORD                                  \
+  {                                                           \
+    .timestamp = UINT64_MAX,                                  \
+    .values = {[0 ... HISTORY_RECORD_VALUES - 1] = 0xffff}    \
+  }
+
+typedef struct {
+  uint8_t width;
+  bool is_max;  // deviations keep their peak, everything else is averaged
+} history_lane_t;
+
+static const history_lane_t history_lanes[HISTORY_LANE_COUNT] = {
+    [HISTORY_LANE_VALUES] = {.width = 2 * NUMBER_OF_CELLS, .is_max = false},
+    [HISTORY_LANE_DEVIATIONS] = {.width = 2 * NUMBER_OF_CELLS, .is_max = true},
+    [HISTORY_LANE_DUTY] = {.width = NUMBER_OF_CELLS, .is_max = false},
+    [HISTORY_LANE_PACK] = {.width = 4, .is_max = false},
+};
+
+// timestamps are stored as uptime and converted when sent
+static history_record_t history_2min_buffer[HISTORY_BUFFER_ELEMENTS] = {
+    [0 ... HISTORY_BUFFER_ELEMENTS - 1] = HISTORY_EMPTY_RECORD};
+static history_record_t history_1h_buffer[HISTORY_BUFFER_ELEMENTS] = {
+    [0 ... HISTORY_BUFFER_ELEMENTS - 1] = HISTORY_EMPTY_RECORD};
+static history_record_t history_12h_buffer[HISTORY_BUFFER_ELEMENTS] = {
+    [0 ... HISTORY_BUFFER_ELEMENTS - 1] = HISTORY_EMPTY_RECORD};
 
 // position of most recent data point
 static uint8_t history_2min_head = HISTORY_BUFFER_ELEMENTS - 1;
 static uint8_t history_1h_head = HISTORY_BUFFER_ELEMENTS - 1;
 static uint8_t history_12h_head = HISTORY_BUFFER_ELEMENTS - 1;
 
-static void history_notify(uint16_t p_buffer[][16],
-                           uint8_t* p_head,
-                           uint8_t type,
-                           bool full) {
-  uint16_t values[BLE_HISTORY_CHAR_LENGTH / sizeof(uint16_t)] = {[0 ... 95] =
-                                                                     0xffff};
+typedef struct {
+  history_record_t* p_buffer;
+  uint8_t head;      // head when the dump was requested
+  uint8_t position;  // records sent so far
+  uint8_t type;
+  uint8_t link;
+  bool is_active;
+} history_dump_t;
 
-  if (full) {
-    for (size_t i = 0; i < HISTORY_BUFFER_ELEMENTS; i++) {
-      uint8_t pos = *p_head + i + 1;
-      pos %= HISTORY_BUFFER_ELEMENTS;
+// every link downloads its own copy at its own pace
+static history_dump_t history_1h_dumps[BLE_LINK_COUNT];
+static history_dump_t history_12h_dumps[BLE_LINK_COUNT];
+
+static bool history_is_lane_enabled(uint8_t lane) {
+  return (HISTORY_LANES & HISTORY_LANE(lane)) != 0;
+}
 
-      memcpy(&values[16 * (i % 6)], p_buffer[pos], sizeof(uint16_t) * 16);
+uint8_t history_get_layout(uint8_t layout[HISTORY_LAYOUT_LENGTH]) {
+  uint8_t length = 3;
+  uint8_t lane_count = 0;
 
-      if (i % 6 == 5) {
-        ble_notify_history_values(values, type);
+  for (uint8_t lane = 0; lane < HISTORY_LANE_COUNT; lane++) {
+    if (history_is_lane_enabled(lane)) {
+      layout[length++] = lane;
+      layout[length++] = history_lanes[lane].width;
+      lane_count++;
+    }
+  }
+  layout[0] = sizeof(history_record_t);
+  layout[1] = BLE_HISTORY_RECORDS;
+  layout[2] = lane_count;
+
+  return length;
+}
+
+static void history_copy_record(history_record_t* p_dst,
+                                history_record_t const* p_src) {
+  *p_dst = *p_src;
+  if (p_src->timestamp != UINT64_MAX) {
+    p_dst->timestamp = timestamp_to_unix(p_src->timestamp);
+  }
+}
+
+static void history_notify_latest(history_record_t p_buffer[],
+                                  uint8_t* p_head,
+                                  uint8_t type) {
+  history_record_t records[BLE_HISTORY_RECORDS];
+  memset(records, 0xff, sizeof(records));
+
+  history_copy_record(&records[0], &p_buffer[*p_head]);
+  ble_notify_history_values(BLE_LINKS_ALL, records, BLE_HISTORY_RECORDS, type);
+}
+
+// full buffers are sent oldest first, only as fast as the bulk queue drains
+static void history_notify_dump(history_dump_t* p_dump) {
+  history_record_t records[BLE_HISTORY_RECORDS];
+
+  while (p_dump->is_active &&
+         ble_queue_has_space(BLE_QUEUE_BULK, p_dump->link)) {
+    if (!is_notification_enabled(p_dump->link, p_dump->type)) {
+      p_dump->is_active = false;
+      break;
+    }
+
+    // a smaller MTU on the link sends fewer records per notification
+    uint8_t count = ble_get_history_records(BLE_LINK(p_dump->link));
+    memset(records, 0xff, sizeof(records));
+    for (size_t i = 0; i < count; i++) {
+      uint8_t pos = p_dump->head + p_dump->position + 1;
+      pos %= HISTORY_BUFFER_ELEMENTS;
+      history_copy_record(&records[i], &p_dump->p_buffer[pos]);
+
+      p_dump->position++;
+      if (p_dump->position == HISTORY_BUFFER_ELEMENTS) {
+        p_dump->is_active = false;
+        break;
       }
     }
-  } else {
-    memcpy(values, p_buffer[*p_head], sizeof(uint16_t) * 16);
-    ble_notify_history_values(values, type);
+    ble_notify_history_values(
+        BLE_LINK(p_dump->link), records, count, p_dump->type);
+  }
+}
+
+static void history_notify_full(history_dump_t* p_dump,
+                                uint8_t link,
+                                history_record_t p_buffer[],
+                                uint8_t* p_head,
+                                uint8_t type) {
+  p_dump->p_buffer = p_buffer;
+  p_dump->head = *p_head;
+  p_dump->type = type;
+  p_dump->link = link;
+  p_dump->position = 0;
+  p_dump->is_active = true;
+  ble_bulk_start(link);
+  history_notify_dump(p_dump);
+}
+
+void history_notify_continue(void) {
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    history_notify_dump(&history_1h_dumps[link]);
+    history_notify_dump(&history_12h_dumps[link]);
   }
 }
 
-void history_notify_1h_full() {
-  history_notify(history_1h_buffer, &history_1h_head, HISTORY_1H, true);
+bool history_is_dump_active(uint8_t link) {
+  return history_1h_dumps[link].is_active ||
+         history_12h_dumps[link].is_active;
 }
 
-void history_notify_12h_full() {
-  history_notify(history_12h_buffer, &history_12h_head, HISTORY_12H, true);
+void history_notify_1h_full(uint8_t link) {
+  history_notify_full(&history_1h_dumps[link],
+                      link,
+                      history_1h_buffer,
+                      &history_1h_head,
+                      HISTORY_1H);
+}
+
+void history_notify_12h_full(uint8_t link) {
+  history_notify_full(&history_12h_dumps[link],
+                      link,
+                      history_12h_buffer,
+                      &history_12h_head,
+                      HISTORY_12H);
 }
 
-static void history_aggregate(uint16_t p_srcbuff[][16],
+static void history_aggregate(history_record_t p_srcbuff[],
                               uint8_t* p_srchead,
-                              uint16_t p_dstbuff[][16],
+                              history_record_t p_dstbuff[],
                               uint8_t* p_dsthead,
                               uint16_t interval) {
   *p_dsthead += 1;
   *p_dsthead %= HISTORY_BUFFER_ELEMENTS;
 
-  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
-    uint32_t sum_v = 0;
-    uint32_t sum_i = 0;
-    for (size_t k = 0; k < interval; k++) {
-      sum_v += p_srcbuff[*p_srchead - k][2 * i];  // underflow?
-      sum_i += p_srcbuff[*p_srchead - k][2 * i + 1];
+  history_record_t* p_dst = &p_dstbuff[*p_dsthead];
+
+  // aggregated record is stamped with the end of its interval
+  p_dst->timestamp = p_srcbuff[*p_srchead].timestamp;
+
+  size_t offset = 0;
+  for (uint8_t lane = 0; lane < HISTORY_LANE_COUNT; lane++) {
+    if (!history_is_lane_enabled(lane)) {
+      continue;
+    }
+    for (size_t i = offset; i < offset + history_lanes[lane].width; i++) {
+      uint32_t sum = 0;
+      uint16_t max = 0;
+      for (size_t k = 0; k < interval; k++) {
+        size_t pos = (HISTORY_BUFFER_ELEMENTS + *p_srchead - k) %
+                     HISTORY_BUFFER_ELEMENTS;
+        uint16_t val = p_srcbuff[pos].values[i];
+        sum += val;
+        max = MAX(max, val);
+      }
+      p_dst->values[i] = history_lanes[lane].is_max ? max : sum / interval;
     }
-    p_dstbuff[*p_dsthead][2 * i] = sum_v / interval;
-    p_dstbuff[*p_dsthead][2 * i + 1] = sum_i / interval;
+    offset += history_lanes[lane].width;
   }
 }
 
-void history_fill_buffer(uint16_t values_buffer[2 * NUMBER_OF_CELLS],
-                         uint16_t seconds) {
+static void history_compose_record(history_record_t* p_record,
+                                   data_record_t const* p_values,
+                                   data_record_t const* p_deviations,
+                                   uint16_t duty[NUMBER_OF_CELLS]) {
+  uint16_t* p_dst = p_record->values;
+
+  if (history_is_lane_enabled(HISTORY_LANE_VALUES)) {
+    memcpy(p_dst, p_values->values, sizeof(p_values->values));
+    p_dst += 2 * NUMBER_OF_CELLS;
+  }
+
+  if (history_is_lane_enabled(HISTORY_LANE_DEVIATIONS)) {
+    memcpy(p_dst, p_deviations->values, sizeof(p_deviations->values));
+    p_dst += 2 * NUMBER_OF_CELLS;
+  }
+
+  if (history_is_lane_enabled(HISTORY_LANE_DUTY)) {
+    memcpy(p_dst, duty, sizeof(uint16_t) * NUMBER_OF_CELLS);
+    p_dst += NUMBER_OF_CELLS;
+  }
+
+  // from the filtered pack summary, biased so the aggregate averages work
+  if (history_is_lane_enabled(HISTORY_LANE_PACK)) {
+    summary_record_t summary;
+    summary_get(&summary);
+    p_dst[0] = (uint16_t)MIN(summary.total_voltage, UINT16_MAX);
+    p_dst[1] = summary.spread;
+    p_dst[2] = summary.lowest_voltage;
+    p_dst[3] = (uint16_t)(summary.spread_trend + SUMMARY_TREND_BIAS);
+  }
+}
+
+// an aggregate covers at most the whole buffer below it
+bool history_are_intervals_valid(uint16_t interval_1h, uint16_t interval_12h) {
+  return (0 < interval_1h) && (interval_1h <= HISTORY_BUFFER_ELEMENTS) &&
+         (interval_12h % interval_1h == 0) && (0 < interval_12h) &&
+         (interval_12h / interval_1h <= HISTORY_BUFFER_ELEMENTS);
+}
+
+void history_fill_buffer(data_record_t const* p_values,
+                         data_record_t const* p_deviations,
+                         uint16_t duty[NUMBER_OF_CELLS],
+                         uint32_t seconds,
+                         uint64_t uptime) {
   history_2min_head++;
   history_2min_head %= HISTORY_BUFFER_ELEMENTS;
-  uint16_t* p_head = &history_2min_buffer[history_2min_head][0];
-  for (size_t i = 0; i < 2 * NUMBER_OF_CELLS; i++) {
-    *(p_head + i) = values_buffer[i];
-  }
-  NRF_LOG_INFO("%i: 2min buffer added @ pos%i", seconds, history_2min_head);
+  history_record_t* p_head = &history_2min_buffer[history_2min_head];
+  p_head->timestamp = uptime;
+  history_compose_record(p_head, p_values, p_deviations, duty);
+  NRF_LOG_INFO("%u: 2min buffer added @ pos%i", seconds, history_2min_head);
 
-  if (seconds % HISTORY_1H_INTERVAL == 0) {
+  config_t const *p_config = config_get();
+  if (seconds % p_config->history_1h_interval == 0) {
     history_aggregate(history_2min_buffer,
                       &history_2min_head,
                       history_1h_buffer,
                       &history_1h_head,
-                      (uint16_t)HISTORY_1H_INTERVAL);
-    history_notify(history_1h_buffer, &history_1h_head, HISTORY_1H, false);
-    NRF_LOG_INFO("%i: 1h buffer added @ pos%i", seconds, history_1h_head);
+                      p_config->history_1h_interval);
+    history_notify_latest(history_1h_buffer, &history_1h_head, HISTORY_1H);
+    NRF_LOG_INFO("%u: 1h buffer added @ pos%i", seconds, history_1h_head);
   }
 
-  if (seconds % HISTORY_12H_INTERVAL == 0) {
-    history_aggregate(history_1h_buffer,
-                      &history_1h_head,
-                      history_12h_buffer,
-                      &history_12h_head,
-                      (uint16_t)HISTORY_12H_1H_INTERVAL);
-    history_notify(history_12h_buffer, &history_12h_head, HISTORY_12H, false);
-    NRF_LOG_INFO("%i: 12h buffer added @ pos%i", seconds, history_12h_head);
+  if (seconds % p_config->history_12h_interval == 0) {
+    history_aggregate(
+        history_1h_buffer,
+        &history_1h_head,
+        history_12h_buffer,
+        &history_12h_head,
+        p_config->history_12h_interval / p_config->history_1h_interval);
+    history_notify_latest(history_12h_buffer, &history_12h_head, HISTORY_12H);
+    NRF_LOG_INFO("%u: 12h buffer added @ pos%i", seconds, history_12h_head);
   }
 }
@@ -4,8 +4,51 @@
 #include "stdint.h"
 #include "stdbool.h"
 
-void history_notify_1h_full(void);
-void history_notify_12h_full(void);
-void history_fill_buffer(uint16_t values_buffer[], uint16_t seconds);
+#include "data.h"
+
+// lanes are stored in this order, each one only if enabled in HISTORY_LANES
+enum {
+  HISTORY_LANE_VALUES,      // voltage 1, current 1, voltage 2, ...
+  HISTORY_LANE_DEVIATIONS,  // same sequence as values
+  HISTORY_LANE_DUTY,        // pwm duty per cell
+  HISTORY_LANE_PACK,        // total, spread, lowest cell, biased spread trend
+  HISTORY_LANE_COUNT
+};
+
+#define HISTORY_LANE(_lane) (1 << (_lane))
+
+// recorded lanes, every lane costs 3 * 120 * 2 bytes per value
+#define HISTORY_LANES                                                 \
+  (HISTORY_LANE(HISTORY_LANE_VALUES) |                                \
+   HISTORY_LANE(HISTORY_LANE_DEVIATIONS) |                            \
+   HISTORY_LANE(HISTORY_LANE_DUTY) | HISTORY_LANE(HISTORY_LANE_PACK))
+
+#define HISTORY_LANE_WIDTH(_lane, _width) \
+  ((HISTORY_LANES & HISTORY_LANE(_lane)) ? (_width) : 0)
+#define HISTORY_RECORD_VALUES                                         \
+  (HISTORY_LANE_WIDTH(HISTORY_LANE_VALUES, 2 * NUMBER_OF_CELLS) +     \
+   HISTORY_LANE_WIDTH(HISTORY_LANE_DEVIATIONS, 2 * NUMBER_OF_CELLS) + \
+   HISTORY_LANE_WIDTH(HISTORY_LANE_DUTY, NUMBER_OF_CELLS) +           \
+   HISTORY_LANE_WIDTH(HISTORY_LANE_PACK, 4))
+
+// record length, records per notification, lane count, (lane, width) pairs
+#define HISTORY_LAYOUT_LENGTH (3 + (2 * HISTORY_LANE_COUNT))
+
+typedef struct {
+  uint64_t timestamp;  // in milliseconds, see timestamp.h
+  uint16_t values[HISTORY_RECORD_VALUES];
+} history_record_t;
+
+void history_notify_1h_full(uint8_t link);
+void history_notify_12h_full(uint8_t link);
+void history_notify_continue(void);
+bool history_is_dump_active(uint8_t link);
+uint8_t history_get_layout(uint8_t layout[HISTORY_LAYOUT_LENGTH]);
+bool history_are_intervals_valid(uint16_t interval_1h, uint16_t interval_12h);
+void history_fill_buffer(data_record_t const* p_values,
+                         data_record_t const* p_deviations,
+                         uint16_t duty[NUMBER_OF_CELLS],
+                         uint32_t seconds,
+                         uint64_t uptime);
 
 #endif  // HISTORY_H
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include "log_binary.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
@@ -10,6 +11,7 @@ void log_init(void) {
   ret_code_t err_code = NRF_LOG_INIT(NULL);
   ERROR_CHECK("LOG init", err_code);
   NRF_LOG_DEFAULT_BACKENDS_INIT();
+  log_binary_init();
 
   NRF_LOG_RAW_INFO(
       "\r\n\e[30;107m\r\n--------------\nLogger "
@@ -0,0 +1,122 @@
+#include "log_binary.h"
+
+#include "nrf_drv_uart.h"
+#include "nrf_log_backend_interface.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_internal.h"
+#include "sdk_config.h"
+
+#define NRF_LOG_MODULE_NAME log_bin
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#if LOG_BACKEND_BINARY_ENABLED
+
+// largest frame, a standard entry with all arguments or a hexdump chunk
+#define LOG_BINARY_MAX_PAYLOAD \
+  (sizeof(uint32_t) * (1 + NRF_LOG_MAX_NUM_OF_ARGS))
+#define LOG_BINARY_MAX_FRAME (LOG_BINARY_HEADER + LOG_BINARY_MAX_PAYLOAD)
+
+static const nrf_drv_uart_t uart = NRF_DRV_UART_INSTANCE(0);
+// EasyDMA only reads from RAM
+static uint8_t frame[LOG_BINARY_MAX_FRAME];
+
+// blocking, the logger runs from the idle loop
+static void log_binary_send(uint8_t kind,
+                            uint32_t module_name,
+                            uint16_t length) {
+  frame[0] = LOG_BINARY_SYNC;
+  frame[1] = kind;
+  frame[2] = length & 0xff;
+  frame[3] = length >> 8;
+  memcpy(&frame[4], &module_name, sizeof(module_name));
+  nrf_drv_uart_tx(&uart, frame, LOG_BINARY_HEADER + length);
+}
+
+static void log_binary_put(nrf_log_backend_t const *p_backend,
+                           nrf_log_entry_t *p_msg) {
+  nrf_log_header_t header;
+  size_t offset = HEADER_SIZE * sizeof(uint32_t);
+  nrf_memobj_get(p_msg);
+  nrf_memobj_read(p_msg, &header, offset, 0);
+
+  uint32_t module_name =
+      (uint32_t)(uintptr_t)nrf_log_module_name_get(header.module_id, false);
+  uint8_t *p_payload = &frame[LOG_BINARY_HEADER];
+
+  if (header.base.generic.type == HEADER_TYPE_STD) {
+    uint8_t nargs = header.base.std.nargs;
+    uint32_t format = header.base.std.addr;
+    memcpy(p_payload, &format, sizeof(format));
+    nrf_memobj_read(
+        p_msg, &p_payload[sizeof(format)], nargs * sizeof(uint32_t), offset);
+    log_binary_send((LOG_BINARY_TYPE_STD << 4) | header.base.std.severity,
+                    module_name,
+                    sizeof(format) + nargs * sizeof(uint32_t));
+  } else if (header.base.generic.type == HEADER_TYPE_HEXDUMP) {
+    // long dumps are split, the decoder joins consecutive chunks
+    uint32_t length = header.base.hexdump.len;
+    for (uint32_t done = 0; done < length;) {
+      uint32_t chunk = MIN(length - done, LOG_BINARY_MAX_PAYLOAD);
+      nrf_memobj_read(p_msg, p_payload, chunk, offset + done);
+      log_binary_send(
+          (LOG_BINARY_TYPE_HEXDUMP << 4) | header.base.hexdump.severity,
+          module_name,
+          chunk);
+      done += chunk;
+    }
+  }
+
+  nrf_memobj_put(p_msg);
+}
+
+// transfers block, a flush only waits for the last frame to leave
+static void log_binary_flush(nrf_log_backend_t const *p_backend) {
+  while (nrf_drv_uart_tx_in_progress(&uart)) {
+  }
+}
+
+static void log_binary_uart_init(void) {
+  nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+  config.pseltxd = NRF_LOG_BACKEND_UART_TX_PIN;
+  config.pselrxd = NRF_UART_PSEL_DISCONNECTED;
+  config.pselcts = NRF_UART_PSEL_DISCONNECTED;
+  config.pselrts = NRF_UART_PSEL_DISCONNECTED;
+  config.baudrate = (nrf_uart_baudrate_t)NRF_LOG_BACKEND_UART_BAUDRATE;
+
+  // no handler, transfers block until done
+  ret_code_t err_code = nrf_drv_uart_init(&uart, &config, NULL);
+  ERROR_CHECK("log UART init", err_code);
+}
+
+// a fault may have stopped a frame halfway, the UART starts over so the
+// final flush still gets the remaining entries out
+static void log_binary_panic_set(nrf_log_backend_t const *p_backend) {
+  nrf_drv_uart_uninit(&uart);
+  log_binary_uart_init();
+}
+
+static const nrf_log_backend_api_t log_binary_api = {
+    .put = log_binary_put,
+    .flush = log_binary_flush,
+    .panic_set = log_binary_panic_set,
+};
+
+NRF_LOG_BACKEND_DEF(log_binary_backend, log_binary_api, NULL);
+
+void log_binary_init(void) {
+  log_binary_uart_init();
+
+  int32_t backend_id =
+      nrf_log_backend_add(&log_binary_backend, NRF_LOG_SEVERITY_DEBUG);
+  if (backend_id < 0) {
+    return;
+  }
+  nrf_log_backend_enable(&log_binary_backend);
+}
+
+#else
+
+void log_binary_init(void) {}
+
+#endif  // LOG_BACKEND_BINARY_ENABLED
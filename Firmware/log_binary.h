@@ -0,0 +1,17 @@
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+// dictionary based log backend, the device sends addresses and raw arguments
+// and Host-App/log_decode.py rebuilds the text from the strings in the ELF
+// frame: sync, kind (type << 4 | severity), payload length (uint16), address
+// of the module name (uint32), then for LOG_BINARY_TYPE_STD the address of the
+// format string and the arguments (uint32 each), for LOG_BINARY_TYPE_HEXDUMP
+// the raw bytes
+#define LOG_BINARY_SYNC         0xA5
+#define LOG_BINARY_HEADER       8
+#define LOG_BINARY_TYPE_STD     1
+#define LOG_BINARY_TYPE_HEXDUMP 2
+
+void log_binary_init(void);
+
+#endif  // LOG_BINARY_H
@@ -1,31 +1,71 @@
 #include "adc.h"
+#include "app_timer.h"
 #include "bluetooth.h"
+#include "boot.h"
+#include "calibration.h"
+#include "chain.h"
+#include "config.h"
 #include "gpio.h"
 #include "log.h"
 #include "mux.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_pwr_mgmt.h"
+#include "power.h"
+#include "protection.h"
 #include "pwm.h"
+#include "schedule.h"
+#include "storage.h"
+#include "timestamp.h"
+#include "trace.h"
+
+static void timers_init(void) {
+  ret_code_t err_code = app_timer_init();
+  ERROR_CHECK("app timer init", err_code);
+}
+
+static void power_management_init(void) {
+  ret_code_t err_code = nrf_pwr_mgmt_init();
+  ERROR_CHECK("power management init", err_code);
+}
 
 static void idle_state_handle(void) {
+  trace_process();  // UART dump, blocks while the log flushes
   if (NRF_LOG_PROCESS() == false) {
+    trace_record(TRACE_IDLE_BEGIN, 0);
     nrf_pwr_mgmt_run();
+    trace_record(TRACE_IDLE_END, 0);
   }
 }
 
 int main(void) {
-  // Initialize.
+  // Initialize, safety path first.
+  boot_init();
+  trace_init();
   log_init();
   gpio_init();
-
-  ble_init();  // creates problems if placed after pwm_start()
+  timers_init();  // counts once the SoftDevice starts the low frequency clock
+  power_management_init();
+  timestamp_init();
+  calibration_init();  // nominal until calibration_load()
 
   pwm_init();
   mux_init();
-  adc_init();
+  protection_init();
+  power_init();
+  boot_stage(BOOT_STAGE_SAFETY);
+  adc_init();  // sampling starts from the SAADC calibration event
+
+  // BLE comes up while the first blocks are sampled and checked
+  ble_init();
+  storage_init();  // requires the SoftDevice from ble_init()
+  calibration_load();
+  chain_init();    // requires storage_init()
+  config_init();   // applies the stored config, before schedule_init()
+  boot_stage(BOOT_STAGE_STORAGE);
 
-  pwm_start();
-  mux_pwm_adc_start();
+  pwm_start();  // creates problems if placed before ble_init()
+  schedule_init();
+  boot_stage(BOOT_STAGE_READY);
 
   // Enter main loop.
   for (;;) {
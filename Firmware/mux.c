@@ -16,16 +16,13 @@ NRF_LOG_MODULE_REGISTER();
 #define PWM_HIGH      (0x8000 + PWM_TOP_VALUE)
 #define PWM_LOW       (0x8000 + 0)
 
-// pin sequence: S0, S1, S2
-static nrf_pwm_values_individual_t pwm_value[] = {
-    {PWM_LOW, PWM_LOW, PWM_HIGH, 0},     // 8
-    {PWM_HIGH, PWM_HIGH, PWM_LOW, 0},    // 1
-    {PWM_LOW, PWM_LOW, PWM_LOW, 0},      // 2
-    {PWM_HIGH, PWM_LOW, PWM_LOW, 0},     // 3
-    {PWM_LOW, PWM_HIGH, PWM_LOW, 0},     // 4
-    {PWM_HIGH, PWM_LOW, PWM_HIGH, 0},    // 5
-    {PWM_LOW, PWM_HIGH, PWM_HIGH, 0},    // 6
-    {PWM_HIGH, PWM_HIGH, PWM_HIGH, 0}};  // 7
+STATIC_ASSERT(BOARD_MUX_SELECT_COUNT <= NRF_PWM_CHANNEL_COUNT,
+              "one PWM instance drives the select pins");
+STATIC_ASSERT((1 << BOARD_MUX_SELECT_COUNT) >= BOARD_MUX_STEP_COUNT,
+              "not enough select pins for the mux steps");
+
+// one step per mux position, channel k drives select pin S<k>
+static nrf_pwm_values_individual_t pwm_value[BOARD_MUX_STEP_COUNT];
 
 static const nrfx_pwm_t pwm2_instance_mux = NRFX_PWM_INSTANCE(2);
 
@@ -41,15 +38,31 @@ void mux_pwm_adc_start(void) {
       &pwm2_instance_mux, &pwm_sequence, PWM_PLAYBACKS, NRFX_PWM_FLAG_LOOP);
 }
 
+static void mux_init_steps(void) {
+  const uint8_t steps[BOARD_MUX_STEP_COUNT] = BOARD_MUX_STEPS;
+
+  for (size_t i = 0; i < BOARD_MUX_STEP_COUNT; i++) {
+    uint16_t *p_channels = (uint16_t *)&pwm_value[i];
+    for (size_t k = 0; k < NRF_PWM_CHANNEL_COUNT; k++) {
+      p_channels[k] = ((steps[i] >> k) & 1) ? PWM_HIGH : PWM_LOW;
+    }
+  }
+}
+
 static void mux_init_pwm(void) {
-  const nrfx_pwm_config_t pwm_config = {
-      .output_pins = {MUX_S0, MUX_S1, MUX_S2, NRFX_PWM_PIN_NOT_USED},
+  const uint32_t select_pins[BOARD_MUX_SELECT_COUNT] = BOARD_MUX_SELECT_PINS;
+  nrfx_pwm_config_t pwm_config = {
+      .output_pins = {[0 ... NRF_PWM_CHANNEL_COUNT - 1] =
+                          NRFX_PWM_PIN_NOT_USED},
       .irq_priority = NRFX_PWM_DEFAULT_CONFIG_IRQ_PRIORITY,
       .base_clock = NRF_PWM_CLK_2MHz,
       .count_mode = NRF_PWM_MODE_UP,
       .top_value = PWM_TOP_VALUE,
       .load_mode = NRF_PWM_LOAD_INDIVIDUAL,
       .step_mode = NRF_PWM_STEP_AUTO};
+  for (size_t i = 0; i < BOARD_MUX_SELECT_COUNT; i++) {
+    pwm_config.output_pins[i] = select_pins[i];
+  }
 
   nrfx_err_t status = nrfx_pwm_init(&pwm2_instance_mux, &pwm_config, NULL);
   ERROR_CHECK("PWM init", status);
@@ -88,10 +101,20 @@ static void mux_init_pwm_stop_ppi(void) {
   ERROR_CHECK("PPI pwm stop enable", status);
 }
 
+// the enable pin is active low
+void mux_set_enabled(bool is_enabled) {
+  if (is_enabled) {
+    nrf_gpio_pin_clear(MUX_EN);
+  } else {
+    nrf_gpio_pin_set(MUX_EN);
+  }
+}
+
 void mux_init(void) {
   nrf_gpio_cfg_output(MUX_EN);
-  nrf_gpio_pin_clear(MUX_EN);
+  mux_set_enabled(true);
 
+  mux_init_steps();
   mux_init_pwm();
   mux_init_adc_sample_ppi();
   mux_init_pwm_stop_ppi();
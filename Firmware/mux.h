@@ -1,7 +1,10 @@
 #ifndef MUX_H
 #define MUX_H
 
+#include <stdbool.h>
+
 void mux_init(void);
 void mux_pwm_adc_start(void);
+void mux_set_enabled(bool is_enabled);
 
 #endif  // MUX_H
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "power.h"
+
+#include "adc.h"
+#include "app_timer.h"
+#include "ble_services.h"
+#include "config.h"
+#include "mux.h"
+#include "nrf.h"
+#include "pwm.h"
+#include "schedule.h"
+
+#define NRF_LOG_MODULE_NAME power
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// milliseconds between two blocks in monitor mode
+#define POWER_INTERVAL_MIN     10
+#define POWER_INTERVAL_MAX     5000
+// full rate is kept this long after the last reason for it
+#define POWER_HOLD_MS          10000
+// a monitor block moving this far from the last one wakes up full rate
+#define POWER_WAKE_VOLTAGE     10
+#define POWER_WAKE_CURRENT     20
+
+// nRF52840 datasheet typicals in microampere for the estimate
+#define POWER_BASE_UA          3     // system on, RTC running
+#define POWER_CPU_UA           3300  // CPU running from flash, DC/DC
+#define POWER_SAADC_UA         1100  // SAADC, mux and PWM2 during a block
+#define POWER_BLOCK_US         1000  // one block including offset calibration
+
+#define POWER_TICKS_PER_SECOND APP_TIMER_CLOCK_FREQ
+// the cycle counter stops while the CPU sleeps, so it only counts awake time
+#define POWER_CYCLES_PER_US    64
+
+typedef struct {
+  uint8_t policy;
+  uint8_t mode;
+  uint16_t interval;
+  uint32_t full_until;  // app timer tick, valid while is_holding
+  bool is_holding;
+  bool is_waiting;  // burst timer running between monitor blocks
+  bool is_reference_valid;
+  uint16_t voltages[NUMBER_OF_CELLS];  // block that set the reference
+  // statistics since the last query, interrupts count as awake, both
+  // counters wrap and are accumulated after every block
+  uint32_t total_ticks;   // app timer ticks
+  uint64_t awake_cycles;  // DWT cycles
+  uint32_t last_ticks;
+  uint32_t last_cycles;
+  uint32_t blocks;
+} power_t;
+
+// policy and interval from the config, see power_init()
+static power_t power = {.mode = POWER_MODE_FULL};
+
+APP_TIMER_DEF(burst_timer);
+
+static void power_hold_full(void) {
+  power.full_until = app_timer_cnt_get() + APP_TIMER_TICKS(POWER_HOLD_MS);
+  power.is_holding = true;
+}
+
+static bool power_is_hold_expired(void) {
+  // the counter is 24 bit, the difference handles the wrap
+  uint32_t remaining =
+      app_timer_cnt_diff_compute(power.full_until, app_timer_cnt_get());
+  return APP_TIMER_TICKS(POWER_HOLD_MS) < remaining;
+}
+
+// subscribers of live data expect every block, dumps do not
+static bool power_has_live_subscribers(void) {
+  return ble_get_subscribers(VALUES) | ble_get_subscribers(DEVIATIONS) |
+         ble_get_subscribers(BATCH) | ble_get_subscribers(CHANGES) |
+         ble_get_subscribers(STREAM);
+}
+
+static bool power_is_duty_active(void) {
+  uint16_t duty[NUMBER_OF_CELLS];
+  pwm_get_values(duty);
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (duty[i] != 0) {
+      return true;
+    }
+  }
+  return pwm_is_balancer_active() || pwm_is_current_active();
+}
+
+static uint8_t power_next_mode(void) {
+  if ((power.policy == POWER_POLICY_FULL) || power_has_live_subscribers() ||
+      power_is_duty_active()) {
+    power_hold_full();
+  }
+  if (power.is_holding && power_is_hold_expired()) {
+    power.is_holding = false;
+  }
+  return power.is_holding ? POWER_MODE_FULL : POWER_MODE_MONITOR;
+}
+
+static void power_start_block(void) {
+  adc_restart();
+  mux_pwm_adc_start();
+}
+
+static void power_burst_handler(void *p_context) {
+  if (!power.is_waiting) {
+    return;  // already started by power_wake()
+  }
+  power.is_waiting = false;
+  mux_set_enabled(true);
+  power_start_block();
+}
+
+static void power_account(void) {
+  uint32_t ticks = app_timer_cnt_get();
+  uint32_t cycles = DWT->CYCCNT;
+  power.total_ticks += app_timer_cnt_diff_compute(ticks, power.last_ticks);
+  power.awake_cycles += cycles - power.last_cycles;
+  power.last_ticks = ticks;
+  power.last_cycles = cycles;
+}
+
+// called after every SAADC block with the SAADC uninitialized
+void power_block_done(void) {
+  power.blocks++;
+  power_account();
+
+  uint8_t mode = power_next_mode();
+  if (mode != power.mode) {
+    NRF_LOG_INFO("%s rate", mode == POWER_MODE_FULL ? "full" : "monitor");
+    power.mode = mode;
+    power.is_reference_valid = false;
+    // nothing new to report between monitor blocks
+    schedule_set_report_on_blocks(mode == POWER_MODE_MONITOR);
+  }
+
+  if (mode == POWER_MODE_FULL) {
+    power_start_block();
+    return;
+  }
+  mux_set_enabled(false);
+  power.is_waiting = true;
+  ret_code_t err_code =
+      app_timer_start(burst_timer, APP_TIMER_TICKS(power.interval), NULL);
+  ERROR_CHECK("burst timer start", err_code);
+}
+
+// a new reason for full rate starts the next block now, not after the
+// monitor interval, the mode follows when that block is done
+void power_wake(void) {
+  if ((power_next_mode() != POWER_MODE_FULL) || !power.is_waiting) {
+    return;
+  }
+  ret_code_t err_code = app_timer_stop(burst_timer);
+  ERROR_CHECK("burst timer stop", err_code);
+  power_burst_handler(NULL);
+}
+
+// a moving cell wakes up full rate, compared against the last monitor block
+void power_check(uint16_t const voltages[NUMBER_OF_CELLS],
+                 uint16_t const currents[NUMBER_OF_CELLS]) {
+  if (power.mode != POWER_MODE_MONITOR) {
+    return;
+  }
+
+  bool is_moving = false;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    int32_t delta = (int32_t)voltages[i] - power.voltages[i];
+    bool is_step =
+        (delta < -POWER_WAKE_VOLTAGE) || (POWER_WAKE_VOLTAGE < delta);
+    is_moving |= power.is_reference_valid && is_step;
+    is_moving |= POWER_WAKE_CURRENT < currents[i];
+  }
+  memcpy(power.voltages, voltages, sizeof(power.voltages));
+  power.is_reference_valid = true;
+
+  if (is_moving) {
+    NRF_LOG_INFO("cells moving, full rate");
+    power_hold_full();
+  }
+}
+
+bool power_is_policy_valid(uint8_t policy, uint16_t interval) {
+  return (policy < POWER_POLICY_COUNT) && (POWER_INTERVAL_MIN <= interval) &&
+         (interval <= POWER_INTERVAL_MAX);
+}
+
+bool power_set_policy(uint8_t policy, uint16_t interval) {
+  if (!power_is_policy_valid(policy, interval)) {
+    return false;
+  }
+  power.policy = policy;
+  power.interval = interval;
+  NRF_LOG_INFO("policy %i, monitor every %i ms", policy, interval);
+  return true;
+}
+
+void power_get_stats(power_stats_t *p_stats) {
+  power_account();
+  uint32_t total = MAX(power.total_ticks, 1);
+  uint64_t total_us =
+      MAX((uint64_t)total * 1000000 / POWER_TICKS_PER_SECOND, 1);
+  uint64_t awake_us = power.awake_cycles / POWER_CYCLES_PER_US;
+  uint32_t sleep_permille = 1000 - MIN(awake_us * 1000 / total_us, 1000);
+  uint32_t block_permille =
+      MIN((uint64_t)power.blocks * POWER_BLOCK_US * 1000 / total_us, 1000);
+
+  p_stats->mode = power.mode;
+  p_stats->sleep_permille = sleep_permille;
+  p_stats->current_ua = POWER_BASE_UA +
+                        POWER_CPU_UA * (1000 - sleep_permille) / 1000 +
+                        POWER_SAADC_UA * block_permille / 1000;
+  p_stats->block_rate =
+      MIN((uint64_t)power.blocks * POWER_TICKS_PER_SECOND / total, UINT16_MAX);
+
+  power.total_ticks = 0;
+  power.awake_cycles = 0;
+  power.blocks = 0;
+}
+
+void power_init(void) {
+  ret_code_t err_code = app_timer_create(
+      &burst_timer, APP_TIMER_MODE_SINGLE_SHOT, power_burst_handler);
+  ERROR_CHECK("burst timer create", err_code);
+
+  power.policy = config_get()->power_policy;
+  power.interval = config_get()->power_interval;
+  // the cycle counter runs without a debugger once trace is enabled
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  power.last_ticks = app_timer_cnt_get();
+  power.last_cycles = DWT->CYCCNT;
+  power_hold_full();
+}
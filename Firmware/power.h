@@ -0,0 +1,37 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data.h"
+
+typedef enum {
+  POWER_POLICY_AUTO,  // monitor rate while nothing needs fresh data
+  POWER_POLICY_FULL,  // back to back blocks, as before
+  POWER_POLICY_COUNT
+} power_policy_t;
+
+typedef enum {
+  POWER_MODE_FULL,     // next block starts right after the last one
+  POWER_MODE_MONITOR,  // SAADC and mux off between single blocks
+} power_mode_t;
+
+// averages since the last query
+typedef struct {
+  uint8_t mode;
+  uint16_t sleep_permille;  // share of time the CPU slept, no ISR time
+  uint16_t current_ua;      // estimate from datasheet typicals, no radio
+  uint16_t block_rate;      // SAADC blocks per second
+} power_stats_t;
+
+void power_init(void);
+void power_block_done(void);
+void power_wake(void);
+void power_check(uint16_t const voltages[NUMBER_OF_CELLS],
+                 uint16_t const currents[NUMBER_OF_CELLS]);
+bool power_is_policy_valid(uint8_t policy, uint16_t interval);
+bool power_set_policy(uint8_t policy, uint16_t interval);
+void power_get_stats(power_stats_t *p_stats);
+
+#endif  // POWER_H
@@ -0,0 +1,220 @@
+#include "protection.h"
+
+#include "calibration.h"
+#include "config.h"
+#include "data.h"
+#include "nrfx_ppi.h"
+#include "nrfx_saadc.h"
+#include "pwm.h"
+#include "trace.h"
+
+#define NRF_LOG_MODULE_NAME protection
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define PROTECTION_VOLTAGE_MIN   3000
+#define PROTECTION_VOLTAGE_MAX   4500
+#define PROTECTION_CURRENT_MAX   1000
+
+#define PROTECTION_CHANNEL_COUNT BOARD_ADC_CHANNEL_COUNT
+// a PPI channel triggers one task and one fork
+#define PROTECTION_PPI_TASKS     2
+
+static const board_cell_t board_cells[NUMBER_OF_CELLS] = BOARD_CELLS;
+
+// from the config, see protection_init()
+static uint16_t voltage_limit;  // mV
+static uint16_t current_limit;  // mA
+
+// first fault is latched until cleared over BLE
+static protection_fault_t latched_fault = PROTECTION_FAULT_NONE;
+static cell_mask_t latched_cells = 0;
+
+// cells whose voltage is sampled on a SAADC channel
+static bool protection_is_on_channel(uint8_t cell, uint8_t channel) {
+  return board_cells[cell].voltage_slot % BOARD_ADC_CHANNEL_COUNT == channel;
+}
+
+static cell_mask_t protection_channel_cells(uint8_t channel) {
+  cell_mask_t cells = 0;
+  for (uint8_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (protection_is_on_channel(i, channel)) {
+      cells |= (cell_mask_t)1 << i;
+    }
+  }
+  return cells;
+}
+
+void protection_trip(protection_fault_t fault, cell_mask_t cells) {
+  if (latched_fault != PROTECTION_FAULT_NONE) {
+    latched_cells |= cells;
+    return;
+  }
+
+  uint16_t zero[NUMBER_OF_CELLS] = {0};
+  pwm_set_balancer_state(false);
+  pwm_set_current_state(false);
+  pwm_update_values(zero);  // manual duty is not reset by the balancer
+  pwm_stop();
+
+  latched_fault = fault;
+  latched_cells = cells;
+  trace_record(TRACE_FAULT, fault);
+  NRF_LOG_ERROR("fault %i on cells 0x%x, balancer stopped", fault, cells);
+}
+
+// lowest raw value of the channel cells that exceeds the voltage limit
+static int16_t protection_channel_limit(uint8_t channel) {
+  uint16_t limit = UINT16_MAX;
+  for (uint8_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (protection_is_on_channel(i, channel)) {
+      uint16_t raw =
+          calibration_to_raw(CALIBRATION_LANE_VOLTAGE, i, voltage_limit);
+      limit = MIN(limit, raw);
+    }
+  }
+  return (int16_t)MIN(limit, INT16_MAX);
+}
+
+// voltage and current slots share both channels, so the limit is set from
+// the voltage threshold and only catches gross overcurrent in hardware
+// needs the advanced mode handler, the mode set rewrites the interrupts
+void protection_limits_apply(void) {
+  for (uint8_t i = 0; i < PROTECTION_CHANNEL_COUNT; i++) {
+    int16_t high = NRFX_SAADC_LIMITH_DISABLED;
+    if (latched_fault == PROTECTION_FAULT_NONE) {
+      high = protection_channel_limit(i);
+    }
+    nrfx_err_t status =
+        nrfx_saadc_limits_set(i, NRFX_SAADC_LIMITL_DISABLED, high);
+    if (status != NRF_SUCCESS) {
+      ERROR_CHECK("SAADC limits set", status);
+      // no balancing without the hardware cutoff
+      protection_trip(PROTECTION_FAULT_UNARMED, protection_channel_cells(i));
+    }
+  }
+}
+
+// the PPI already stopped the PWM, this only records the fault
+void protection_limit_event(uint8_t channel) {
+  if (PROTECTION_CHANNEL_COUNT <= channel) {
+    return;
+  }
+  protection_trip(PROTECTION_FAULT_LIMIT, protection_channel_cells(channel));
+  protection_limits_apply();  // stop the limit interrupts of this block
+}
+
+void protection_check(uint16_t const voltages[], uint16_t const currents[]) {
+  cell_mask_t overvoltage = 0;
+  cell_mask_t overcurrent = 0;
+
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (voltage_limit < voltages[i]) {
+      overvoltage |= (cell_mask_t)1 << i;
+    }
+    if (current_limit < currents[i]) {
+      overcurrent |= (cell_mask_t)1 << i;
+    }
+  }
+
+  if (overvoltage) {
+    protection_trip(PROTECTION_FAULT_OVERVOLTAGE, overvoltage);
+  }
+  if (overcurrent) {
+    protection_trip(PROTECTION_FAULT_OVERCURRENT, overcurrent);
+  }
+}
+
+// lower voltage limits would trip the shared channels on normal currents
+bool protection_are_limits_valid(uint16_t voltage, uint16_t current) {
+  return (PROTECTION_VOLTAGE_MIN <= voltage) &&
+         (voltage <= PROTECTION_VOLTAGE_MAX) && (0 < current) &&
+         (current <= PROTECTION_CURRENT_MAX);
+}
+
+bool protection_set_limits(uint16_t voltage, uint16_t current) {
+  if (!protection_are_limits_valid(voltage, current)) {
+    return false;
+  }
+  voltage_limit = voltage;
+  current_limit = current;
+  NRF_LOG_INFO("limits %i mV, %i mA", voltage, current);
+
+  return true;
+}
+
+uint16_t protection_get_current_limit(void) {
+  return current_limit;
+}
+
+bool protection_is_tripped(void) {
+  return latched_fault != PROTECTION_FAULT_NONE;
+}
+
+protection_fault_t protection_get_fault(cell_mask_t *p_cells) {
+  *p_cells = latched_cells;
+  return latched_fault;
+}
+
+// limits are programmed again with the next SAADC block
+void protection_clear(void) {
+  if (latched_fault == PROTECTION_FAULT_NONE) {
+    return;
+  }
+  latched_fault = PROTECTION_FAULT_NONE;
+  latched_cells = 0;
+  pwm_start();
+  NRF_LOG_INFO("fault cleared");
+}
+
+// stops every balancer instance driving a cell sampled on the channel
+static void protection_init_ppi(uint8_t channel) {
+  nrf_ppi_channel_t ppi_channel;
+  nrfx_err_t status;
+  uint8_t tasks = 0;
+
+  status = nrfx_ppi_channel_alloc(&ppi_channel);
+  ERROR_CHECK("PPI protection alloc", status);
+
+  for (uint8_t instance = 0; instance < PWM_INSTANCE_COUNT; instance++) {
+    bool is_used = false;
+    for (uint8_t i = 0; i < NUMBER_OF_CELLS; i++) {
+      is_used |= (PWM_INSTANCE(i) == instance) &&
+                 protection_is_on_channel(i, channel);
+    }
+    if (!is_used) {
+      continue;
+    }
+
+    if (tasks == PROTECTION_PPI_TASKS) {
+      NRF_LOG_WARNING(
+          "channel %i: PWM%i not stopped by PPI", channel, instance);
+      continue;
+    }
+    uint32_t task = pwm_stop_task_address_get(instance);
+    if (tasks == 0) {
+      status = nrfx_ppi_channel_assign(
+          ppi_channel,
+          nrf_saadc_event_address_get(
+              nrf_saadc_limit_event_get(channel, NRF_SAADC_LIMIT_HIGH)),
+          task);
+    } else {
+      status = nrfx_ppi_channel_fork_assign(ppi_channel, task);
+    }
+    ERROR_CHECK("PPI protection assign", status);
+    tasks++;
+  }
+
+  status = nrfx_ppi_channel_enable(ppi_channel);
+  ERROR_CHECK("PPI protection enable", status);
+}
+
+// a limit event stops the balancer PWM of its cells without the CPU
+void protection_init(void) {
+  voltage_limit = config_get()->voltage_limit;
+  current_limit = config_get()->current_limit;
+
+  for (uint8_t i = 0; i < PROTECTION_CHANNEL_COUNT; i++) {
+    protection_init_ppi(i);
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef PROTECTION_H
+#define PROTECTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data.h"
+
+typedef enum {
+  PROTECTION_FAULT_NONE,
+  PROTECTION_FAULT_LIMIT,        // SAADC channel limit, stopped by PPI
+  PROTECTION_FAULT_OVERVOLTAGE,  // cell voltage block average
+  PROTECTION_FAULT_OVERCURRENT,  // balancing current block average
+  PROTECTION_FAULT_BALANCER,     // open or stuck FET, see pwm.c
+  PROTECTION_FAULT_UNARMED,      // SAADC limit could not be set
+} protection_fault_t;
+
+void protection_init(void);
+void protection_limits_apply(void);
+void protection_limit_event(uint8_t channel);
+void protection_check(uint16_t const voltages[], uint16_t const currents[]);
+bool protection_are_limits_valid(uint16_t voltage, uint16_t current);
+bool protection_set_limits(uint16_t voltage, uint16_t current);
+void protection_trip(protection_fault_t fault, cell_mask_t cells);
+uint16_t protection_get_current_limit(void);
+bool protection_is_tripped(void);
+protection_fault_t protection_get_fault(cell_mask_t *p_cells);
+void protection_clear(void);
+
+#endif  // PROTECTION_H
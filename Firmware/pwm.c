@@ -2,150 +2,344 @@
 
 #include "adc.h"
 #include "board.h"
+#include "capture.h"
+#include "config.h"
+#include "data.h"
 #include "mux.h"
 #include "nrfx_ppi.h"
 #include "nrfx_pwm.h"
+#include "power.h"
+#include "protection.h"
 #include "sdk_config.h"
+#include "trace.h"
 
 #define NRF_LOG_MODULE_NAME pwm
 #include "log.h"
 NRF_LOG_MODULE_REGISTER();
 
-#define CHARGE_TERM_VOLT_MAX 3600
-#define CHARGE_TERM_HYST     10
-#define CHARGE_TERM_RANGE    20
-
-#define PWM_TOP_VALUE        100
 #define PWM_REPEATS          0
 #define PWM_END_DELAY        0
 #define PWM_PLAYBACKS        1
 
-#define PWM_LIMIT            75
+// current mode, the duty steps once per block while outside the deadband,
+// it grows with the current of one duty step
+#define PWM_CURRENT_DEADBAND 2  // mA
+// blocks of disagreeing duty and current before the balancer fault trips
+#define PWM_MISMATCH_BLOCKS  100
+// hardly any bleed current at a substantial duty, in percent and mA
+#define PWM_OPEN_DUTY        20
+#define PWM_OPEN_CURRENT     5
+// bleed current that flows without any duty, in mA
+#define PWM_STUCK_CURRENT    20
 
-static uint16_t pwm_current_values[8] = {0};
-static uint16_t pwm_term_volt_individual[8] = {CHARGE_TERM_VOLT_MAX};
+// termination voltage, hysteresis, range and duty limit are in the config
+static uint16_t pwm_current_values[NUMBER_OF_CELLS] = {0};
+static uint16_t pwm_term_volt_max;
+static uint16_t pwm_term_volt_individual[NUMBER_OF_CELLS];
 
 static bool is_balancing_active = false;
+// target bleed current in mA, the duty follows the measured current
+static bool is_current_active = false;
+static uint16_t pwm_target_currents[NUMBER_OF_CELLS] = {0};
+static uint8_t pwm_mismatch_blocks[NUMBER_OF_CELLS] = {0};
+// lowest cell of the whole daisy chain, see chain.h
+static uint16_t pwm_pack_lowest = PWM_PACK_LOWEST_NONE;
+
+// cells are assigned to the instances in board order, four per instance
+static const nrfx_pwm_t pwm_instances[] = {
+    NRFX_PWM_INSTANCE(0),
+#if PWM_INSTANCE_COUNT > 1
+    NRFX_PWM_INSTANCE(1),
+#endif
+#if PWM_INSTANCE_COUNT > 2
+    NRFX_PWM_INSTANCE(3),  // PWM2 drives the mux
+#endif
+};
+#if PWM_INSTANCE_COUNT > 2 && !NRFX_PWM3_ENABLED
+#error "more than 8 cells need NRFX_PWM3_ENABLED in sdk_config.h"
+#endif
+STATIC_ASSERT(ARRAY_SIZE(pwm_instances) == PWM_INSTANCE_COUNT,
+              "three PWM instances are left for balancing");
+
+static nrf_pwm_values_individual_t pwm_values[PWM_INSTANCE_COUNT] = {
+    [0 ... PWM_INSTANCE_COUNT - 1] = {0x8000, 0x8000, 0x8000, 0x8000}};
 
-static nrf_pwm_values_individual_t pwm_value_14[] = {
-    {0x8000, 0x8000, 0x8000, 0x8000}};
-static nrf_pwm_values_individual_t pwm_value_58[] = {
-    {0x8000, 0x8000, 0x8000, 0x8000}};
-
-static const nrfx_pwm_t pwm0_instance_bal14 = NRFX_PWM_INSTANCE(0);
-static const nrfx_pwm_t pwm1_instance_bal58 = NRFX_PWM_INSTANCE(1);
-
-static const nrf_pwm_sequence_t pwm_sequence_14 = {
-    .values.p_individual = pwm_value_14,
-    .length = NRF_PWM_VALUES_LENGTH(pwm_value_14),
-    .repeats = PWM_REPEATS,
-    .end_delay = PWM_END_DELAY};
-static const nrf_pwm_sequence_t pwm_sequence_58 = {
-    .values.p_individual = pwm_value_58,
-    .length = NRF_PWM_VALUES_LENGTH(pwm_value_58),
-    .repeats = PWM_REPEATS,
-    .end_delay = PWM_END_DELAY};
+static nrf_pwm_sequence_t pwm_sequences[PWM_INSTANCE_COUNT];
 
 static void pwm_apply_values() {
-  pwm_value_14->channel_0 = 0x8000 + pwm_current_values[0];
-  pwm_value_14->channel_1 = 0x8000 + pwm_current_values[1];
-  pwm_value_14->channel_2 = 0x8000 + pwm_current_values[2];
-  pwm_value_14->channel_3 = 0x8000 + pwm_current_values[3];
-  pwm_value_58->channel_0 = 0x8000 + pwm_current_values[4];
-  pwm_value_58->channel_1 = 0x8000 + pwm_current_values[5];
-  pwm_value_58->channel_2 = 0x8000 + pwm_current_values[6];
-  pwm_value_58->channel_3 = 0x8000 + pwm_current_values[7];
+  static uint16_t applied_values[NUMBER_OF_CELLS] = {0};
+  if (memcmp(applied_values, pwm_current_values, sizeof(applied_values))) {
+    memcpy(applied_values, pwm_current_values, sizeof(applied_values));
+    capture_pwm_changed();
+
+    uint16_t duty_sum = 0;
+    for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+      duty_sum += pwm_current_values[i];
+    }
+    trace_record(TRACE_PWM_UPDATE, duty_sum);
+  }
+
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    uint16_t *p_channels = (uint16_t *)&pwm_values[PWM_INSTANCE(i)];
+    p_channels[PWM_CHANNEL(i)] = 0x8000 + pwm_current_values[i];
+  }
 }
 
-void pwm_toggle_balancer_state() {
-  if (is_balancing_active) {
+void pwm_set_balancer_state(bool is_active) {
+  if (is_active == is_balancing_active) {
+    return;
+  }
+  if (is_active && protection_is_tripped()) {
+    NRF_LOG_WARNING("balancer blocked by fault");
+    return;
+  }
+  if (is_active) {
+    is_current_active = false;  // takes over from the current duty
+    nrf_gpio_pin_clear(BALANCING_LED);  // on
+    NRF_LOG_INFO("balancer enabled");
+  } else {
     memset(pwm_current_values, 0, sizeof(pwm_current_values));
     pwm_apply_values();
     nrf_gpio_pin_set(BALANCING_LED);  // off
     NRF_LOG_INFO("balancer disabled");
-  } else {
+  }
+  is_balancing_active = is_active;
+  if (is_active) {
+    power_wake();
+  }
+}
+
+void pwm_set_current_state(bool is_active) {
+  if (is_active == is_current_active) {
+    return;
+  }
+  if (is_active && protection_is_tripped()) {
+    NRF_LOG_WARNING("current mode blocked by fault");
+    return;
+  }
+  if (is_active) {
+    is_balancing_active = false;
+    memset(pwm_mismatch_blocks, 0, sizeof(pwm_mismatch_blocks));
     nrf_gpio_pin_clear(BALANCING_LED);  // on
-    NRF_LOG_INFO("balancer enabled");
+    NRF_LOG_INFO("current mode enabled");
+  } else {
+    memset(pwm_current_values, 0, sizeof(pwm_current_values));
+    pwm_apply_values();
+    nrf_gpio_pin_set(BALANCING_LED);  // off
+    NRF_LOG_INFO("current mode disabled");
+  }
+  is_current_active = is_active;
+  if (is_active) {
+    power_wake();
+  }
+}
+
+bool pwm_is_current_active(void) {
+  return is_current_active;
+}
+
+void pwm_set_target_currents(cell_mask_t mask,
+                             uint16_t const currents[NUMBER_OF_CELLS]) {
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (mask & ((cell_mask_t)1 << i)) {
+      pwm_target_currents[i] = currents[i];
+    }
+  }
+  NRF_LOG_INFO("target currents set, mask 0x%x", mask);
+}
+
+void pwm_toggle_balancer_state() {
+  pwm_set_balancer_state(!is_balancing_active);
+}
+
+bool pwm_is_balancer_active(void) {
+  return is_balancing_active;
+}
+
+bool pwm_is_target_valid(uint16_t voltage) {
+  return (PWM_TARGET_MIN <= voltage) && (voltage <= PWM_TARGET_MAX);
+}
+
+bool pwm_set_target(uint16_t voltage) {
+  if (!pwm_is_target_valid(voltage)) {
+    NRF_LOG_WARNING("termination voltage %i mV rejected", voltage);
+    return false;
   }
-  is_balancing_active = !is_balancing_active;
+  pwm_term_volt_max = voltage;
+  NRF_LOG_INFO("termination voltage %i mV", voltage);
+
+  return true;
 }
 
-void pwm_update_values(uint16_t values[8]) {
+uint16_t pwm_get_target(void) {
+  return pwm_term_volt_max;
+}
+
+void pwm_update_values(uint16_t values[NUMBER_OF_CELLS]) {
+  if (protection_is_tripped()) {
+    NRF_LOG_WARNING("duty blocked by fault");
+    return;
+  }
   for (size_t i = 0; i < ARRAY_SIZE(pwm_current_values); i++) {
     pwm_current_values[i] = values[i];
   }
   pwm_apply_values();
+  power_wake();
 }
 
-static void pwm_calculate_term_volt(uint16_t voltages[8]) {
-  uint16_t lowest_voltage = 5000;
-  for (size_t i = 0; i < 8; i++) {
-    if (500 < voltages[i]) {
+void pwm_get_values(uint16_t values[NUMBER_OF_CELLS]) {
+  memcpy(values, pwm_current_values, sizeof(pwm_current_values));
+}
+
+void pwm_set_pack_lowest(uint16_t voltage) {
+  pwm_pack_lowest = voltage;
+}
+
+static void pwm_calculate_term_volt(uint16_t voltages[NUMBER_OF_CELLS]) {
+  uint16_t lowest_voltage = MIN(5000, pwm_pack_lowest);
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    if (PWM_MIN_CELL_VOLTAGE < voltages[i]) {
       lowest_voltage = MIN(voltages[i], lowest_voltage);
     }
   }
 
   uint16_t upper_bound =
-      MIN(lowest_voltage + CHARGE_TERM_RANGE, CHARGE_TERM_VOLT_MAX);
-  for (size_t i = 0; i < 8; i++) {
+      MIN(lowest_voltage + config_get()->term_range, pwm_term_volt_max);
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
     pwm_term_volt_individual[i] = MAX(upper_bound, pwm_term_volt_individual[i]);
   }
 }
 
-void pwm_calculate_next_values(uint16_t voltages[8]) {
+void pwm_calculate_next_values(uint16_t voltages[NUMBER_OF_CELLS]) {
   if (is_balancing_active) {
     pwm_calculate_term_volt(voltages);
+    config_t const *p_config = config_get();
+    uint16_t hysteresis = p_config->term_hysteresis;
     for (size_t i = 0; i < ARRAY_SIZE(pwm_current_values); i++) {
-      if (((pwm_term_volt_individual[i] + CHARGE_TERM_HYST) < voltages[i]) &&
-          (pwm_current_values[i] < PWM_LIMIT)) {
+      if (((pwm_term_volt_individual[i] + hysteresis) < voltages[i]) &&
+          (pwm_current_values[i] < p_config->duty_limit)) {
         pwm_current_values[i]++;
-      } else if ((voltages[i] <
-                  (pwm_term_volt_individual[i] - CHARGE_TERM_HYST)) &&
+      } else if ((voltages[i] < (pwm_term_volt_individual[i] - hysteresis)) &&
                  (0 < pwm_current_values[i])) {
         pwm_current_values[i]--;
       }
     }
     pwm_apply_values();
   } else {
-    for (size_t i = 0; i < 8; i++) {
-      pwm_term_volt_individual[i] = MIN(voltages[i], CHARGE_TERM_VOLT_MAX);
+    for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+      pwm_term_volt_individual[i] = MIN(voltages[i], pwm_term_volt_max);
+    }
+  }
+}
+
+// duty and current disagree: no current at a substantial duty (open FET or
+// resistor) or current without any duty (stuck FET), a target out of reach
+// of the resistor is not a fault
+static bool pwm_is_mismatch(uint8_t cell, uint16_t current) {
+  uint16_t duty = pwm_current_values[cell];
+  if ((PWM_OPEN_DUTY <= duty) && (current < PWM_OPEN_CURRENT)) {
+    return true;
+  }
+  return (duty == 0) && (PWM_STUCK_CURRENT < current);
+}
+
+// a step is worth current / duty, below half of that the loop would hunt,
+// three quarters leave a margin for the noise of the block average
+static int32_t pwm_current_deadband(uint16_t current, uint16_t duty) {
+  int32_t deadband = PWM_CURRENT_DEADBAND;
+  if (duty != 0) {
+    deadband = MAX(deadband, (3 * (int32_t)current) / (4 * duty));
+  }
+  return deadband;
+}
+
+// block averages, one duty step per block like the voltage balancer
+void pwm_regulate_currents(uint16_t const currents[NUMBER_OF_CELLS],
+                           uint16_t const voltages[NUMBER_OF_CELLS]) {
+  if (!is_current_active) {
+    return;
+  }
+
+  uint16_t limit = config_get()->duty_limit;
+  cell_mask_t mismatch = 0;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    int32_t error = (int32_t)pwm_target_currents[i] - currents[i];
+    int32_t deadband =
+        pwm_current_deadband(currents[i], pwm_current_values[i]);
+    if ((deadband < error) && (pwm_current_values[i] < limit)) {
+      pwm_current_values[i]++;
+    } else if ((error < -deadband) && (0 < pwm_current_values[i])) {
+      pwm_current_values[i]--;
+    }
+
+    // unconnected cells can not draw any current
+    if ((PWM_MIN_CELL_VOLTAGE < voltages[i]) &&
+        pwm_is_mismatch(i, currents[i])) {
+      if (PWM_MISMATCH_BLOCKS <= ++pwm_mismatch_blocks[i]) {
+        mismatch |= (cell_mask_t)1 << i;
+      }
+    } else {
+      pwm_mismatch_blocks[i] = 0;
     }
   }
+  pwm_apply_values();
+
+  if (mismatch != 0) {
+    protection_trip(PROTECTION_FAULT_BALANCER, mismatch);
+  }
 }
 
 void pwm_start(void) {
-  nrfx_pwm_simple_playback(&pwm0_instance_bal14,
-                           &pwm_sequence_14,
-                           PWM_PLAYBACKS,
-                           NRFX_PWM_FLAG_LOOP);
-  nrfx_pwm_simple_playback(&pwm1_instance_bal58,
-                           &pwm_sequence_58,
-                           PWM_PLAYBACKS,
-                           NRFX_PWM_FLAG_LOOP);
+  for (size_t i = 0; i < PWM_INSTANCE_COUNT; i++) {
+    nrfx_pwm_simple_playback(&pwm_instances[i],
+                             &pwm_sequences[i],
+                             PWM_PLAYBACKS,
+                             NRFX_PWM_FLAG_LOOP);
+  }
+}
+
+void pwm_stop(void) {
+  for (size_t i = 0; i < PWM_INSTANCE_COUNT; i++) {
+    nrfx_pwm_stop(&pwm_instances[i], false);
+  }
+}
+
+uint32_t pwm_stop_task_address_get(uint8_t instance) {
+  return nrfx_pwm_task_address_get(&pwm_instances[instance],
+                                   NRF_PWM_TASK_STOP);
 }
 
 void pwm_init(void) {
-  const nrfx_pwm_config_t pwm_config_14 = {
-      .output_pins = {BAL1_PIN, BAL2_PIN, BAL3_PIN, BAL4_PIN},
-      .irq_priority = NRFX_PWM_DEFAULT_CONFIG_IRQ_PRIORITY,
-      .base_clock = NRF_PWM_CLK_1MHz,
-      .count_mode = NRF_PWM_MODE_UP,
-      .top_value = PWM_TOP_VALUE,
-      .load_mode = NRF_PWM_LOAD_INDIVIDUAL,
-      .step_mode = NRF_PWM_STEP_AUTO};
-
-  nrfx_err_t status = nrfx_pwm_init(&pwm0_instance_bal14, &pwm_config_14, NULL);
-  ERROR_CHECK("PWM0 init", status);
-
-  const nrfx_pwm_config_t pwm_config_58 = {
-      .output_pins = {BAL5_PIN, BAL6_PIN, BAL7_PIN, BAL8_PIN},
-      .irq_priority = NRFX_PWM_DEFAULT_CONFIG_IRQ_PRIORITY,
-      .base_clock = NRF_PWM_CLK_1MHz,
-      .count_mode = NRF_PWM_MODE_UP,
-      .top_value = PWM_TOP_VALUE,
-      .load_mode = NRF_PWM_LOAD_INDIVIDUAL,
-      .step_mode = NRF_PWM_STEP_AUTO};
-
-  status = nrfx_pwm_init(&pwm1_instance_bal58, &pwm_config_58, NULL);
-  ERROR_CHECK("PWM1 init", status);
+  const board_cell_t cells[NUMBER_OF_CELLS] = BOARD_CELLS;
+
+  pwm_term_volt_max = config_get()->term_voltage;
+  for (size_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    pwm_term_volt_individual[i] = pwm_term_volt_max;
+  }
+
+  for (size_t i = 0; i < PWM_INSTANCE_COUNT; i++) {
+    nrfx_pwm_config_t pwm_config = {
+        .output_pins = {[0 ... NRF_PWM_CHANNEL_COUNT - 1] =
+                            NRFX_PWM_PIN_NOT_USED},
+        .irq_priority = NRFX_PWM_DEFAULT_CONFIG_IRQ_PRIORITY,
+        .base_clock = NRF_PWM_CLK_1MHz,
+        .count_mode = NRF_PWM_MODE_UP,
+        .top_value = PWM_TOP_VALUE,
+        .load_mode = NRF_PWM_LOAD_INDIVIDUAL,
+        .step_mode = NRF_PWM_STEP_AUTO};
+    for (size_t k = 0; k < NUMBER_OF_CELLS; k++) {
+      if (PWM_INSTANCE(k) == i) {
+        pwm_config.output_pins[PWM_CHANNEL(k)] = cells[k].balancer_pin;
+      }
+    }
+
+    pwm_sequences[i] = (nrf_pwm_sequence_t){
+        .values.p_individual = &pwm_values[i],
+        .length = NRF_PWM_VALUES_LENGTH(pwm_values[i]),
+        .repeats = PWM_REPEATS,
+        .end_delay = PWM_END_DELAY};
+
+    nrfx_err_t status = nrfx_pwm_init(&pwm_instances[i], &pwm_config, NULL);
+    ERROR_CHECK("PWM init", status);
+  }
 }
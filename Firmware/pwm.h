@@ -1,12 +1,46 @@
 #ifndef PWM_H
 #define PWM_H
 
+#include "data.h"
 #include "nrfx_pwm.h"
 
+// duty cycle values are in percent
+#define PWM_TOP_VALUE          100
+
+// cells below this are treated as not connected when looking for the lowest
+#define PWM_MIN_CELL_VOLTAGE   500
+// no pack wide minimum, balancing only looks at the local cells
+#define PWM_PACK_LOWEST_NONE   UINT16_MAX
+
+// termination voltages outside would bleed healthy cells or never balance
+#define PWM_TARGET_MIN         2500
+#define PWM_TARGET_MAX         4300
+
+// balancer instance and channel of a cell
+#define PWM_INSTANCE_COUNT \
+  ((NUMBER_OF_CELLS + NRF_PWM_CHANNEL_COUNT - 1) / NRF_PWM_CHANNEL_COUNT)
+#define PWM_INSTANCE(_cell) ((_cell) / NRF_PWM_CHANNEL_COUNT)
+#define PWM_CHANNEL(_cell)  ((_cell) % NRF_PWM_CHANNEL_COUNT)
+
 void pwm_init(void);
 void pwm_start(void);
-void pwm_update_values(uint16_t values[8]);
-void pwm_calculate_next_values(uint16_t voltages[8]);
+void pwm_stop(void);
+uint32_t pwm_stop_task_address_get(uint8_t instance);
+void pwm_update_values(uint16_t values[NUMBER_OF_CELLS]);
+void pwm_get_values(uint16_t values[NUMBER_OF_CELLS]);
+void pwm_calculate_next_values(uint16_t voltages[NUMBER_OF_CELLS]);
+void pwm_set_pack_lowest(uint16_t voltage);
 void pwm_toggle_balancer_state(void);
+void pwm_set_balancer_state(bool is_active);
+bool pwm_is_balancer_active(void);
+bool pwm_is_target_valid(uint16_t voltage);
+bool pwm_set_target(uint16_t voltage);
+uint16_t pwm_get_target(void);
+void pwm_regulate_currents(uint16_t const currents[NUMBER_OF_CELLS],
+                           uint16_t const voltages[NUMBER_OF_CELLS]);
+void pwm_set_target_currents(cell_mask_t mask,
+                             uint16_t const currents[NUMBER_OF_CELLS]);
+void pwm_set_current_state(bool is_active);
+bool pwm_is_current_active(void);
 
 #endif  // PWM_H
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "schedule.h"
+
+#include "app_timer.h"
+#include "chain.h"
+#include "config.h"
+#include "data.h"
+#include "trace.h"
+
+#define NRF_LOG_MODULE_NAME schedule
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define SCHEDULE_MAX_PERIOD 60000
+// blocks arrive with about a millisecond of jitter, tasks that follow them
+// are due that much early
+#define SCHEDULE_BLOCK_SLACK APP_TIMER_TICKS(1)
+
+typedef struct {
+  app_timer_id_t const *p_timer;  // NULL always follows the blocks
+  void (*handler)(void);
+  uint16_t period;
+  uint16_t min_period;  // below this the task only repeats old data
+  bool is_on_blocks;    // runs on SAADC block completion, timer stopped
+  uint32_t last_ticks;  // RTC ticks of the last run on a block
+} schedule_entry_t;
+
+APP_TIMER_DEF(report_timer);
+APP_TIMER_DEF(history_timer);
+APP_TIMER_DEF(chain_timer);
+
+// timer handlers run at APP_IRQ_PRIORITY_LOW like the SAADC handler, so the
+// tasks never see half updated acquisition data, periods are from the config
+static schedule_entry_t schedule[SCHEDULE_TASK_COUNT] = {
+    [SCHEDULE_CONTROL] = {.p_timer = NULL,
+                          .handler = data_control,
+                          .min_period = 1,
+                          .is_on_blocks = true},
+    [SCHEDULE_REPORT] = {.p_timer = &report_timer,
+                         .handler = data_report,
+                         .min_period = 100},
+    [SCHEDULE_HISTORY] = {.p_timer = &history_timer,
+                          .handler = data_record_history,
+                          .min_period = 100},
+    // a round of four boards takes about 50 ms on the wire
+    [SCHEDULE_CHAIN] = {.p_timer = &chain_timer,
+                        .handler = chain_round,
+                        .min_period = 100},
+};
+
+static void schedule_timeout_handler(void *p_context) {
+  schedule_entry_t const *p_entry = p_context;
+  trace_record(TRACE_TASK_BEGIN, p_entry - schedule);
+  p_entry->handler();
+  trace_record(TRACE_TASK_END, p_entry - schedule);
+}
+
+static void schedule_start(schedule_entry_t *p_entry) {
+  if (p_entry->is_on_blocks) {
+    return;
+  }
+  ret_code_t err_code = app_timer_start(
+      *p_entry->p_timer, APP_TIMER_TICKS(p_entry->period), p_entry);
+  ERROR_CHECK("schedule timer start", err_code);
+}
+
+bool schedule_is_period_valid(uint8_t task, uint16_t period) {
+  return (task < SCHEDULE_TASK_COUNT) &&
+         (schedule[task].min_period <= period) &&
+         (period <= SCHEDULE_MAX_PERIOD);
+}
+
+bool schedule_set_period(uint8_t task, uint16_t period) {
+  if (!schedule_is_period_valid(task, period)) {
+    return false;
+  }
+
+  schedule_entry_t *p_entry = &schedule[task];
+  if (!p_entry->is_on_blocks) {
+    ret_code_t err_code = app_timer_stop(*p_entry->p_timer);
+    ERROR_CHECK("schedule timer stop", err_code);
+  }
+  p_entry->period = period;
+  schedule_start(p_entry);
+  NRF_LOG_INFO("task %i every %i ms", task, period);
+
+  return true;
+}
+
+uint16_t schedule_get_period(uint8_t task) { return schedule[task].period; }
+
+// tasks that only have work with new data follow the blocks instead of
+// waking the CPU on a timer, the control step always, the report at the
+// monitor rate, see power.c
+void schedule_block_done(void) {
+  uint32_t now = app_timer_cnt_get();
+  for (size_t i = 0; i < SCHEDULE_TASK_COUNT; i++) {
+    schedule_entry_t *p_entry = &schedule[i];
+    if (!p_entry->is_on_blocks || (p_entry->period == 0)) {
+      continue;  // on its timer or before schedule_init()
+    }
+    uint32_t elapsed = app_timer_cnt_diff_compute(now, p_entry->last_ticks);
+    if (elapsed + SCHEDULE_BLOCK_SLACK < APP_TIMER_TICKS(p_entry->period)) {
+      continue;
+    }
+    p_entry->last_ticks = now;
+    schedule_timeout_handler(p_entry);
+  }
+}
+
+void schedule_set_report_on_blocks(bool is_on_blocks) {
+  schedule_entry_t *p_entry = &schedule[SCHEDULE_REPORT];
+  if (is_on_blocks == p_entry->is_on_blocks) {
+    return;
+  }
+  // the timer is created and started in schedule_init()
+  if (is_on_blocks && (p_entry->period != 0)) {
+    ret_code_t err_code = app_timer_stop(*p_entry->p_timer);
+    ERROR_CHECK("schedule timer stop", err_code);
+  }
+  p_entry->last_ticks = app_timer_cnt_get();
+  p_entry->is_on_blocks = is_on_blocks;
+  if (p_entry->period != 0) {
+    schedule_start(p_entry);
+  }
+}
+
+void schedule_init(void) {
+  ret_code_t err_code;
+
+  for (size_t i = 0; i < SCHEDULE_TASK_COUNT; i++) {
+    if (schedule[i].p_timer != NULL) {
+      err_code = app_timer_create(schedule[i].p_timer,
+                                  APP_TIMER_MODE_REPEATED,
+                                  schedule_timeout_handler);
+      ERROR_CHECK("schedule timer create", err_code);
+    }
+    schedule[i].period = config_get()->periods[i];
+    schedule_start(&schedule[i]);
+  }
+}
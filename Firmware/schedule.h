@@ -0,0 +1,23 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  SCHEDULE_CONTROL,  // balancing step after a new SAADC block
+  SCHEDULE_REPORT,   // live notifications and broadcast
+  SCHEDULE_HISTORY,  // one entry in the shortest history buffer
+  SCHEDULE_CHAIN,    // summary exchange with the other boards of the pack
+  SCHEDULE_TASK_COUNT
+} schedule_task_t;
+
+// all periods are in milliseconds
+void schedule_init(void);
+bool schedule_is_period_valid(uint8_t task, uint16_t period);
+bool schedule_set_period(uint8_t task, uint16_t period);
+uint16_t schedule_get_period(uint8_t task);
+void schedule_block_done(void);
+void schedule_set_report_on_blocks(bool is_on_blocks);
+
+#endif  // SCHEDULE_H
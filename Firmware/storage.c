@@ -0,0 +1,221 @@
+#include "storage.h"
+
+#include "fds.h"
+#include "nrf_pwr_mgmt.h"
+
+#define NRF_LOG_MODULE_NAME storage
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define STORAGE_FILE_ID     0x0BA1
+#define STORAGE_MAX_RECORDS 4
+
+// flash writes finish asynchronously and FDS does not copy the data, so
+// every key keeps the copy being written and the latest one requested
+typedef struct {
+  uint16_t key;
+  uint16_t length;
+  uint16_t flash_length;
+  bool is_in_flight;  // FDS owns flash_data until the write event
+  bool is_pending;    // waiting for garbage collection to free space
+  bool is_dirty;      // data is newer than flash_data
+  uint32_t data[STORAGE_MAX_LENGTH / sizeof(uint32_t)];
+  uint32_t flash_data[STORAGE_MAX_LENGTH / sizeof(uint32_t)];
+} storage_record_t;
+
+static storage_record_t records[STORAGE_MAX_RECORDS];
+static volatile bool is_initialized = false;
+static storage_handler_t storage_handler = NULL;
+
+static void storage_notify(uint8_t event, uint16_t key) {
+  if (storage_handler != NULL) {
+    storage_handler(event, key);
+  }
+}
+
+static storage_record_t *storage_get_record(uint16_t key) {
+  storage_record_t *p_free = NULL;
+
+  for (size_t i = 0; i < STORAGE_MAX_RECORDS; i++) {
+    if (records[i].key == key) {
+      return &records[i];
+    }
+    if (records[i].key == 0 && p_free == NULL) {
+      p_free = &records[i];
+    }
+  }
+  if (p_free != NULL) {
+    p_free->key = key;
+  }
+  return p_free;
+}
+
+static ret_code_t storage_write_record(storage_record_t *p_record) {
+  fds_record_desc_t desc = {0};
+  fds_find_token_t token = {0};
+  fds_record_t const fds_record = {
+      .file_id = STORAGE_FILE_ID,
+      .key = p_record->key,
+      .data.p_data = p_record->flash_data,
+      .data.length_words = (p_record->flash_length + 3) / sizeof(uint32_t),
+  };
+
+  ret_code_t status =
+      fds_record_find(STORAGE_FILE_ID, p_record->key, &desc, &token);
+  if (status == FDS_SUCCESS) {
+    status = fds_record_update(&desc, &fds_record);
+  } else {
+    status = fds_record_write(&desc, &fds_record);
+  }
+
+  // retried once when garbage collection is done
+  if ((status == FDS_ERR_NO_SPACE_IN_FLASH) && !p_record->is_pending) {
+    p_record->is_pending = true;
+    storage_notify(STORAGE_EVT_GC_START, 0);
+    return fds_gc();
+  }
+  p_record->is_pending = false;
+  return status;
+}
+
+// one write per key at a time, fds_record_find does not see queued writes
+static bool storage_issue(storage_record_t *p_record) {
+  memcpy(p_record->flash_data, p_record->data, p_record->length);
+  p_record->flash_length = p_record->length;
+  p_record->is_dirty = false;
+
+  ret_code_t status = storage_write_record(p_record);
+  ERROR_CHECK("FDS write", status);
+  p_record->is_in_flight = (status == FDS_SUCCESS);
+
+  return p_record->is_in_flight;
+}
+
+// writes that came in meanwhile are coalesced, only the latest is reported
+static void storage_write_done(uint16_t key, ret_code_t result) {
+  storage_record_t *p_record = storage_get_record(key);
+  if (p_record == NULL) {
+    return;
+  }
+  p_record->is_in_flight = false;
+  ERROR_CHECK("FDS write", result);
+
+  if (p_record->is_dirty) {
+    if (!storage_issue(p_record)) {
+      storage_notify(STORAGE_EVT_FAILED, key);
+    }
+  } else if (result == FDS_SUCCESS) {
+    NRF_LOG_INFO("record 0x%04x stored", key);
+    storage_notify(STORAGE_EVT_STORED, key);
+  } else {
+    storage_notify(STORAGE_EVT_FAILED, key);
+  }
+}
+
+static void storage_fds_handler(fds_evt_t const *p_evt) {
+  switch (p_evt->id) {
+    case FDS_EVT_INIT:
+      ERROR_CHECK("FDS init", p_evt->result);
+      is_initialized = true;
+      break;
+    case FDS_EVT_WRITE:
+    case FDS_EVT_UPDATE:
+      storage_write_done(p_evt->write.record_key, p_evt->result);
+      break;
+    case FDS_EVT_GC:
+      storage_notify(STORAGE_EVT_GC_DONE, 0);
+      for (size_t i = 0; i < STORAGE_MAX_RECORDS; i++) {
+        if (!records[i].is_pending) {
+          continue;
+        }
+        ret_code_t status = storage_write_record(&records[i]);
+        if (status != FDS_SUCCESS) {
+          ERROR_CHECK("FDS write", status);  // flash is full
+          storage_write_done(records[i].key, status);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+bool storage_read(uint16_t key, void *p_data, uint16_t length) {
+  fds_record_desc_t desc = {0};
+  fds_find_token_t token = {0};
+  fds_flash_record_t flash_record = {0};
+
+  if (fds_record_find(STORAGE_FILE_ID, key, &desc, &token) != FDS_SUCCESS) {
+    return false;
+  }
+  if (fds_record_open(&desc, &flash_record) != FDS_SUCCESS) {
+    return false;
+  }
+
+  // records of an older layout are ignored
+  bool is_valid =
+      flash_record.p_header->length_words == (length + 3) / sizeof(uint32_t);
+  if (is_valid) {
+    memcpy(p_data, flash_record.p_data, length);
+  }
+  fds_record_close(&desc);
+
+  return is_valid;
+}
+
+// points into flash, valid until the next garbage collection moves the record
+void const *storage_map(uint16_t key, uint16_t length) {
+  fds_record_desc_t desc = {0};
+  fds_find_token_t token = {0};
+  fds_flash_record_t flash_record = {0};
+
+  if (fds_record_find(STORAGE_FILE_ID, key, &desc, &token) != FDS_SUCCESS) {
+    return NULL;
+  }
+  if (fds_record_open(&desc, &flash_record) != FDS_SUCCESS) {
+    return NULL;
+  }
+
+  bool is_valid =
+      flash_record.p_header->length_words == (length + 3) / sizeof(uint32_t);
+  void const *p_data = is_valid ? flash_record.p_data : NULL;
+  fds_record_close(&desc);
+
+  return p_data;
+}
+
+bool storage_write(uint16_t key, void const *p_data, uint16_t length) {
+  storage_record_t *p_record = storage_get_record(key);
+  if (p_record == NULL || STORAGE_MAX_LENGTH < length) {
+    return false;
+  }
+
+  memcpy(p_record->data, p_data, length);
+  p_record->length = length;
+  if (p_record->is_in_flight) {
+    p_record->is_dirty = true;  // written after the current write
+    return true;
+  }
+
+  return storage_issue(p_record);
+}
+
+void storage_set_handler(storage_handler_t handler) {
+  storage_handler = handler;
+}
+
+// requires the SoftDevice, flash access is scheduled around radio events
+void storage_init(void) {
+  ret_code_t status = fds_register(storage_fds_handler);
+  ERROR_CHECK("FDS register", status);
+
+  status = fds_init();
+  ERROR_CHECK("FDS init", status);
+  if (status != NRF_SUCCESS) {
+    return;
+  }
+
+  while (!is_initialized) {
+    nrf_pwr_mgmt_run();
+  }
+}
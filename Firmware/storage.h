@@ -0,0 +1,32 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// largest record, every key keeps two copies of this size in RAM
+#define STORAGE_MAX_LENGTH 256
+
+// record keys in the application file, 0x0000 and 0xc000+ are reserved
+typedef enum {
+  STORAGE_KEY_CALIBRATION = 0x0001,
+  STORAGE_KEY_CHAIN = 0x0002,
+  STORAGE_KEY_CONFIG = 0x0003,
+} storage_key_t;
+
+typedef enum {
+  STORAGE_EVT_STORED,    // the latest write of a key finished, arg: key
+  STORAGE_EVT_FAILED,    // the latest write of a key was lost, arg: key
+  STORAGE_EVT_GC_START,  // mapped records are about to move
+  STORAGE_EVT_GC_DONE,
+} storage_evt_t;
+
+typedef void (*storage_handler_t)(uint8_t event, uint16_t key);
+
+void storage_init(void);
+bool storage_read(uint16_t key, void *p_data, uint16_t length);
+void const *storage_map(uint16_t key, uint16_t length);
+bool storage_write(uint16_t key, void const *p_data, uint16_t length);
+void storage_set_handler(storage_handler_t handler);
+
+#endif  // STORAGE_H
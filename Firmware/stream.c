@@ -0,0 +1,123 @@
+#include "stream.h"
+
+#include "adc.h"
+#include "ble_queue.h"
+#include "ble_services.h"
+#include "bluetooth.h"
+
+#define NRF_LOG_MODULE_NAME stream
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define STREAM_SAMPLE_MAX ((1 << 12) - 1)
+
+typedef struct {
+  adc_slot_mask_t slots;  // mux slots to send, bit per buffer column
+  uint8_t slot_count;     // samples per row
+  uint8_t decimation;     // send every nth buffer
+  uint8_t block;          // buffers since the last one sent
+  uint16_t sequence;
+  uint32_t overruns;      // rows dropped because the bulk queue was full
+  // packet under construction
+  uint8_t packet[BLE_NOTIFY_MAX_LENGTH];
+  uint16_t samples;       // samples already in the packet
+  uint8_t rows;
+  uint8_t links;         // subscribers during the last buffer
+  uint16_t max_samples;  // fit the smallest MTU of the subscribers
+} stream_t;
+
+static stream_t stream = {
+    .slots = ADC_SLOT_MASK_ALL, .slot_count = ADC_SLOT_COUNT, .decimation = 1};
+
+bool stream_configure(adc_slot_mask_t slots, uint8_t decimation) {
+  if ((slots == 0) || (slots & ~ADC_SLOT_MASK_ALL) || (decimation == 0)) {
+    return false;
+  }
+
+  stream.slots = slots;
+  stream.slot_count = __builtin_popcount(slots);
+  stream.decimation = decimation;
+  stream.samples = 0;
+  stream.rows = 0;
+  NRF_LOG_INFO("streaming slots 0x%x every %i buffers", slots, decimation);
+  return true;
+}
+
+static bool stream_has_room(void) {
+  return stream.samples + stream.slot_count <= stream.max_samples;
+}
+
+static void stream_send(uint8_t links) {
+  stream.packet[0] = stream.sequence & 0xff;
+  stream.packet[1] = stream.sequence >> 8;
+  for (size_t i = 0; i < ADC_SLOT_MASK_BYTES; i++) {
+    stream.packet[2 + i] = (stream.slots >> (8 * i)) & 0xff;
+  }
+  stream.packet[STREAM_HEADER_LENGTH - 1] = stream.rows;
+  stream.sequence++;
+
+  uint16_t length = STREAM_HEADER_LENGTH + (stream.samples * 3 + 1) / 2;
+  if (!ble_queue_push(BLE_QUEUE_BULK,
+                      links,
+                      ble_get_service()->stream_handles.value_handle,
+                      stream.packet,
+                      length)) {
+    stream.overruns += stream.rows;
+  }
+  stream.samples = 0;
+  stream.rows = 0;
+}
+
+static void stream_add_sample(nrf_saadc_value_t value) {
+  uint16_t sample = MIN(MAX(value, 0), STREAM_SAMPLE_MAX);
+  uint8_t *p_data =
+      &stream.packet[STREAM_HEADER_LENGTH + (stream.samples / 2) * 3];
+
+  if (stream.samples % 2 == 0) {
+    p_data[0] = sample & 0xff;
+    p_data[1] = sample >> 8;
+  } else {
+    p_data[1] |= (sample & 0x0f) << 4;
+    p_data[2] = sample >> 4;
+  }
+  stream.samples++;
+}
+
+// runs in the SAADC handler, rows are dropped rather than stalling it
+void stream_process_buffer(nrf_saadc_value_t const *p_buffer) {
+  uint8_t links = ble_get_subscribers(STREAM);
+  if (links != stream.links) {
+    NRF_LOG_INFO("stream subscribers 0x%02x, %u rows dropped so far",
+                 links,
+                 stream.overruns);
+    stream.links = links;
+    stream.samples = 0;
+    stream.rows = 0;
+  }
+  if (links == 0) {
+    return;
+  }
+  // a link without room for one row drops the packets in the queue
+  uint16_t length = ble_get_notify_length(links) - STREAM_HEADER_LENGTH;
+  stream.max_samples = MAX(length * 2 / 3, stream.slot_count);
+
+  if (++stream.block < stream.decimation) {
+    return;
+  }
+  stream.block = 0;
+
+  for (size_t row = 0; row < ADC_ROW_COUNT; row++) {
+    nrf_saadc_value_t const *p_row = &p_buffer[row * ADC_SLOT_COUNT];
+    for (size_t slot = 0; slot < ADC_SLOT_COUNT; slot++) {
+      if (stream.slots & ((adc_slot_mask_t)1 << slot)) {
+        stream_add_sample(p_row[slot]);
+      }
+    }
+    stream.rows++;
+
+    if (!stream_has_room()) {
+      stream_send(links);
+    }
+  }
+  ble_queue_flush();
+}
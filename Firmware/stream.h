@@ -0,0 +1,19 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adc.h"
+#include "nrf_saadc.h"
+
+// notification: sequence (uint16, gaps mean dropped rows), slot mask
+// (ADC_SLOT_MASK_BYTES), row count (uint8), then every row as packed 12 bit
+// samples of the selected slots, two samples in three bytes as a little
+// endian bit stream
+#define STREAM_HEADER_LENGTH (2 + ADC_SLOT_MASK_BYTES + 1)
+
+void stream_process_buffer(nrf_saadc_value_t const *p_buffer);
+bool stream_configure(adc_slot_mask_t slots, uint8_t decimation);
+
+#endif  // STREAM_H
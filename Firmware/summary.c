@@ -0,0 +1,110 @@
+#include "summary.h"
+
+#include "ble_services.h"
+#include "pwm.h"
+#include "timestamp.h"
+
+#define NRF_LOG_MODULE_NAME summary
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// the spread is averaged over a window, the trend compares two windows
+#define SUMMARY_TREND_WINDOW_MS  60000
+#define SUMMARY_SECONDS_PER_HOUR 3600
+#define SUMMARY_UV_PER_MV        1000
+// the newest window weighs 1 / 4 in the smoothed trend
+#define SUMMARY_TREND_WEIGHT     4
+
+typedef struct {
+  summary_record_t record;
+  // spread sum of the current window in mV, one entry per block
+  uint32_t spread_sum;
+  uint32_t blocks;
+  uint64_t window_start;     // uptime in ms
+  int32_t last_mean;         // spread of the last window in uV
+  int32_t trend;             // smoothed, in uV per hour
+  bool is_last_mean_valid;
+} summary_t;
+
+static summary_t summary;
+
+// per SAADC block on the filtered voltages, open cells are left out of the
+// lowest and highest like in the balancer
+void summary_update(uint16_t const voltages[NUMBER_OF_CELLS]) {
+  summary_record_t *p_record = &summary.record;
+  uint32_t total = 0;
+  uint16_t lowest = UINT16_MAX;
+  uint16_t highest = 0;
+  uint8_t lowest_cell = 0;
+  uint8_t highest_cell = 0;
+
+  for (uint8_t i = 0; i < NUMBER_OF_CELLS; i++) {
+    total += voltages[i];
+    if (voltages[i] <= PWM_MIN_CELL_VOLTAGE) {
+      continue;
+    }
+    if (voltages[i] < lowest) {
+      lowest = voltages[i];
+      lowest_cell = i;
+    }
+    if (highest < voltages[i]) {
+      highest = voltages[i];
+      highest_cell = i;
+    }
+  }
+  if (highest == 0) {  // no cell connected
+    lowest = 0;
+  }
+
+  p_record->total_voltage = total;
+  p_record->lowest_voltage = lowest;
+  p_record->highest_voltage = highest;
+  p_record->spread = highest - lowest;
+  p_record->lowest_cell = lowest_cell;
+  p_record->highest_cell = highest_cell;
+  summary.spread_sum += p_record->spread;
+  summary.blocks++;
+}
+
+// rounds half away from zero, truncation would hide slow trends
+static int32_t summary_divide(int64_t dividend, int32_t divisor) {
+  int64_t half = (dividend < 0) ? -(divisor / 2) : (divisor / 2);
+  return (dividend + half) / divisor;
+}
+
+static void summary_close_window(uint64_t uptime) {
+  uint32_t elapsed = uptime - summary.window_start;
+  int32_t mean = (uint64_t)summary.spread_sum * 1000 / summary.blocks;
+
+  if (summary.is_last_mean_valid) {
+    // uV per ms is mV per s
+    int32_t trend = summary_divide((int64_t)(mean - summary.last_mean) *
+                                       SUMMARY_SECONDS_PER_HOUR *
+                                       SUMMARY_UV_PER_MV,
+                                   elapsed);
+    summary.trend +=
+        summary_divide(trend - summary.trend, SUMMARY_TREND_WEIGHT);
+    int32_t spread_trend = summary_divide(summary.trend, SUMMARY_UV_PER_MV);
+    summary.record.spread_trend = MIN(MAX(spread_trend, INT16_MIN), INT16_MAX);
+  }
+  summary.last_mean = mean;
+  summary.is_last_mean_valid = true;
+  summary.window_start = uptime;
+  summary.spread_sum = 0;
+  summary.blocks = 0;
+}
+
+// once per reporting period, a single small read for slow clients
+void summary_report(uint64_t uptime) {
+  if ((SUMMARY_TREND_WINDOW_MS <= uptime - summary.window_start) &&
+      (0 < summary.blocks)) {
+    summary_close_window(uptime);
+  }
+
+  summary.record.timestamp = timestamp_to_unix(uptime);
+  summary.record.is_balancing =
+      pwm_is_balancer_active() || pwm_is_current_active();
+  ble_notify_summary(&summary.record);
+}
+
+void summary_get(summary_record_t *p_record) { *p_record = summary.record; }
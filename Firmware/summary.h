@@ -0,0 +1,30 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data.h"
+
+// history stores the trend with this bias, so averaging works on uint16
+#define SUMMARY_TREND_BIAS 0x8000
+
+// pack level facts of this board, little endian, keep in sync with Host-App
+typedef struct {
+  uint64_t timestamp;        // unix time in ms, see timestamp.h
+  uint32_t total_voltage;    // mV, all cells
+  uint16_t lowest_voltage;   // mV, weakest connected cell
+  uint16_t highest_voltage;  // mV
+  uint16_t spread;           // highest - lowest in mV
+  int16_t spread_trend;      // mV per hour, positive while the cells diverge
+  uint8_t lowest_cell;       // 0 based
+  uint8_t highest_cell;
+  uint8_t is_balancing;
+  uint8_t reserved;
+} summary_record_t;
+
+void summary_update(uint16_t const voltages[NUMBER_OF_CELLS]);
+void summary_report(uint64_t uptime);
+void summary_get(summary_record_t *p_record);
+
+#endif  // SUMMARY_H
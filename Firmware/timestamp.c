@@ -0,0 +1,64 @@
+#include "timestamp.h"
+
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "sdk_config.h"
+
+#define NRF_LOG_MODULE_NAME timestamp
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define TIMESTAMP_TICKS_PER_SECOND \
+  (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1))
+
+// the 24 bit RTC counter wraps after 1024 s, fold it in well before that
+#define TIMESTAMP_FOLD_INTERVAL APP_TIMER_TICKS(60000)
+
+APP_TIMER_DEF(fold_timer);
+
+static uint64_t total_ticks = 0;
+static uint32_t last_counter = 0;
+
+// wall clock minus uptime, zero until the host syncs the time
+static uint64_t unix_offset = 0;
+static bool is_synced = false;
+
+uint64_t timestamp_get_uptime(void) {
+  uint64_t ticks;
+
+  CRITICAL_REGION_ENTER();
+  uint32_t counter = app_timer_cnt_get();
+  total_ticks += app_timer_cnt_diff_compute(counter, last_counter);
+  last_counter = counter;
+  ticks = total_ticks;
+  CRITICAL_REGION_EXIT();
+
+  return ticks * 1000 / TIMESTAMP_TICKS_PER_SECOND;
+}
+
+// unsynced timestamps stay plain uptime, far below any plausible unix time
+uint64_t timestamp_to_unix(uint64_t uptime) { return uptime + unix_offset; }
+
+void timestamp_sync(uint64_t unix_time) {
+  unix_offset = unix_time - timestamp_get_uptime();
+  is_synced = true;
+  NRF_LOG_INFO("time synced, offset %u s", (uint32_t)(unix_offset / 1000));
+}
+
+bool timestamp_is_synced(void) { return is_synced; }
+
+static void timestamp_fold_handler(void *p_context) {
+  (void)timestamp_get_uptime();
+}
+
+void timestamp_init(void) {
+  ret_code_t err_code;
+
+  last_counter = app_timer_cnt_get();
+
+  err_code = app_timer_create(
+      &fold_timer, APP_TIMER_MODE_REPEATED, timestamp_fold_handler);
+  ERROR_CHECK("timestamp timer create", err_code);
+  err_code = app_timer_start(fold_timer, TIMESTAMP_FOLD_INTERVAL, NULL);
+  ERROR_CHECK("timestamp timer start", err_code);
+}
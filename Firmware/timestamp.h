@@ -0,0 +1,14 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// all timestamps are in milliseconds
+void timestamp_init(void);
+uint64_t timestamp_get_uptime(void);
+uint64_t timestamp_to_unix(uint64_t uptime);
+void timestamp_sync(uint64_t unix_time);
+bool timestamp_is_synced(void);
+
+#endif  // TIMESTAMP_H
@@ -0,0 +1,183 @@
+#include "trace.h"
+
+#include "app_util_platform.h"
+#include "ble_queue.h"
+#include "ble_services.h"
+#include "bluetooth.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_timer.h"
+
+#define NRF_LOG_MODULE_NAME trace
+#include "log.h"
+NRF_LOG_MODULE_REGISTER();
+
+// number of events kept, must be a power of two
+#define TRACE_EVENTS    512
+// hex dump lines of one event each between two log flushes on the UART
+#define TRACE_LOG_FLUSH 32
+// 1 MHz while recording, the RTC ticks are longer than most spans
+#define TRACE_TIMER     NRF_TIMER3
+
+typedef struct {
+  uint16_t position;  // events sent so far
+  bool is_active;
+} trace_dump_t;
+
+static trace_event_t trace_events[TRACE_EVENTS];
+// free running, only the low bits index the ring
+static uint32_t trace_head = 0;
+static volatile bool is_recording = false;
+// UART dump requested from a handler, sent from the main loop
+static volatile bool is_log_dump_pending = false;
+// oldest event and number of events of the frozen trace
+static uint16_t trace_start_index = 0;
+static uint16_t trace_count = 0;
+static trace_dump_t trace_dumps[BLE_LINK_COUNT];
+
+// microseconds since trace_start(), the capture register is shared
+static uint32_t trace_now(void) {
+  uint32_t now;
+  CRITICAL_REGION_ENTER();
+  nrf_timer_task_trigger(TRACE_TIMER, NRF_TIMER_TASK_CAPTURE0);
+  now = nrf_timer_cc_read(TRACE_TIMER, NRF_TIMER_CC_CHANNEL0);
+  CRITICAL_REGION_EXIT();
+  return now;
+}
+
+// called from every priority, so the slot is claimed with ldrex/strex
+void trace_record(uint8_t id, uint16_t arg) {
+  if (!is_recording) {
+    return;
+  }
+  uint32_t index = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+  trace_event_t *p_event = &trace_events[index & (TRACE_EVENTS - 1)];
+  p_event->ticks = trace_now();
+  p_event->id = id;
+  p_event->arg = arg;
+}
+
+bool trace_is_dump_active(uint8_t link) { return trace_dumps[link].is_active; }
+
+static bool trace_is_any_dump_active(void) {
+  if (is_log_dump_pending) {
+    return true;
+  }
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    if (trace_dumps[link].is_active) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the ring is read in place, so recording stops until trace_start()
+static void trace_freeze(void) {
+  if (!is_recording) {
+    return;
+  }
+  is_recording = false;
+  // the timer keeps the high frequency clock running
+  nrf_timer_task_trigger(TRACE_TIMER, NRF_TIMER_TASK_STOP);
+
+  uint32_t head = trace_head;
+  trace_count = MIN(head, TRACE_EVENTS);
+  trace_start_index = (head - trace_count) & (TRACE_EVENTS - 1);
+  NRF_LOG_INFO("frozen with %i events", trace_count);
+}
+
+void trace_start(void) {
+  if (trace_is_any_dump_active()) {
+    return;
+  }
+  trace_head = 0;
+  nrf_timer_task_trigger(TRACE_TIMER, NRF_TIMER_TASK_CLEAR);
+  nrf_timer_task_trigger(TRACE_TIMER, NRF_TIMER_TASK_START);
+  is_recording = true;
+}
+
+static void trace_dump(trace_dump_t *p_dump, uint8_t link) {
+  uint8_t packet[BLE_NOTIFY_MAX_LENGTH];
+  uint16_t handle = ble_get_service()->trace_handles.value_handle;
+  uint16_t length = MAX(ble_get_notify_length(BLE_LINK(link)),
+                        TRACE_HEADER_LENGTH + sizeof(trace_event_t));
+  uint8_t packet_events =
+      (length - TRACE_HEADER_LENGTH) / sizeof(trace_event_t);
+
+  while (p_dump->is_active && ble_queue_has_space(BLE_QUEUE_BULK, link)) {
+    if (!is_notification_enabled(link, TRACE) ||
+        (p_dump->position == trace_count)) {
+      p_dump->is_active = false;
+      break;
+    }
+
+    uint8_t count = MIN(packet_events, trace_count - p_dump->position);
+    packet[0] = p_dump->position & 0xff;
+    packet[1] = p_dump->position >> 8;
+    packet[2] = trace_count & 0xff;
+    packet[3] = trace_count >> 8;
+    packet[4] = count;
+    for (size_t i = 0; i < count; i++) {
+      uint16_t index =
+          (trace_start_index + p_dump->position++) & (TRACE_EVENTS - 1);
+      memcpy(&packet[TRACE_HEADER_LENGTH + i * sizeof(trace_event_t)],
+             &trace_events[index],
+             sizeof(trace_event_t));
+    }
+    ble_queue_push(BLE_QUEUE_BULK,
+                   BLE_LINK(link),
+                   handle,
+                   packet,
+                   TRACE_HEADER_LENGTH + count * sizeof(trace_event_t));
+  }
+  ble_queue_flush();
+}
+
+// link BLE_LINK_INVALID dumps to the log UART from trace_process()
+bool trace_read(uint8_t link) {
+  if (trace_is_any_dump_active()) {
+    return false;
+  }
+  trace_freeze();
+
+  if (link != BLE_LINK_INVALID) {
+    trace_dumps[link].position = 0;
+    trace_dumps[link].is_active = true;
+    ble_bulk_start(link);
+    trace_dump(&trace_dumps[link], link);
+    return true;
+  }
+  is_log_dump_pending = true;
+  return true;
+}
+
+// runs in the main loop, the flushes block for tens of milliseconds
+void trace_process(void) {
+  if (!is_log_dump_pending) {
+    return;
+  }
+
+  NRF_LOG_RAW_INFO("trace %u events\n", trace_count);
+  for (size_t i = 0; i < trace_count; i++) {
+    uint16_t index = (trace_start_index + i) & (TRACE_EVENTS - 1);
+    NRF_LOG_RAW_HEXDUMP_INFO(&trace_events[index], sizeof(trace_event_t));
+    if ((i % TRACE_LOG_FLUSH) == TRACE_LOG_FLUSH - 1) {
+      NRF_LOG_FLUSH();
+    }
+  }
+  NRF_LOG_RAW_INFO("trace end\n");
+  NRF_LOG_FLUSH();
+  is_log_dump_pending = false;
+}
+
+void trace_notify_continue(void) {
+  for (uint8_t link = 0; link < BLE_LINK_COUNT; link++) {
+    trace_dump(&trace_dumps[link], link);
+  }
+}
+
+void trace_init(void) {
+  nrf_timer_mode_set(TRACE_TIMER, NRF_TIMER_MODE_TIMER);
+  nrf_timer_bit_width_set(TRACE_TIMER, NRF_TIMER_BIT_WIDTH_32);
+  nrf_timer_frequency_set(TRACE_TIMER, NRF_TIMER_FREQ_1MHz);
+  trace_start();
+}
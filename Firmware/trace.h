@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// notification: offset of the first event (uint16), events in the frozen
+// trace (uint16), event count (uint8), then trace_event_t from the oldest
+#define TRACE_HEADER_LENGTH 5
+
+// keep in sync with Host-App/trace_convert.py
+typedef enum {
+  TRACE_SAADC_BEGIN,  // SAADC block done, arg: none
+  TRACE_SAADC_END,
+  TRACE_SAADC_LIMIT,  // arg: SAADC channel
+  TRACE_BLE_BEGIN,    // arg: SoftDevice event id
+  TRACE_BLE_END,
+  TRACE_TASK_BEGIN,   // arg: schedule task
+  TRACE_TASK_END,
+  TRACE_PWM_UPDATE,   // arg: sum of all duty cycles
+  TRACE_COMMAND,      // arg: opcode
+  TRACE_CHAIN_FRAME,  // arg: frame sequence
+  TRACE_FAULT,        // arg: protection fault
+  TRACE_IDLE_BEGIN,   // main loop goes to sleep
+  TRACE_IDLE_END,
+  TRACE_BOOT_STAGE,   // arg: boot stage
+  TRACE_EVENT_COUNT
+} trace_event_id_t;
+
+typedef struct {
+  uint32_t ticks;  // microseconds since trace_start(), wraps after 71 min
+  uint8_t id;
+  uint8_t reserved;
+  uint16_t arg;
+} trace_event_t;
+
+void trace_init(void);
+void trace_record(uint8_t id, uint16_t arg);
+void trace_start(void);
+bool trace_read(uint8_t link);
+void trace_process(void);
+void trace_notify_continue(void);
+bool trace_is_dump_active(uint8_t link);
+
+#endif  // TRACE_H
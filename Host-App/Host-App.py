@@ -3,16 +3,77 @@ import tkinter as tk
 import asyncio
 from bleak import BleakClient, BleakScanner
 import struct
+import sys
+import time
 import seaborn
 import screeninfo
 
 from matplotlib.backends.backend_tkagg import FigureCanvasTkAgg, NavigationToolbar2Tk
 from matplotlib.figure import Figure
 
+# opcodes of the command characteristic, see Firmware/command.h
+COMMAND_SET_DUTY = 0x01
+COMMAND_SET_MODE = 0x02
+COMMAND_SET_TARGET = 0x03
+COMMAND_QUERY = 0x04
+COMMAND_SET_BATCH = 0x05
+COMMAND_SET_DEADBAND = 0x06
+COMMAND_SET_HEARTBEAT = 0x07
+COMMAND_SET_RATE = 0x08
+COMMAND_SET_STREAM = 0x09
+COMMAND_CAPTURE_ARM = 0x0A
+COMMAND_CAPTURE_READ = 0x0B
+COMMAND_SET_LIMITS = 0x0C
+COMMAND_FAULT_QUERY = 0x0D
+COMMAND_FAULT_CLEAR = 0x0E
+COMMAND_SET_FILTER = 0x0F
+COMMAND_SET_REPORT = 0x10
+COMMAND_CAL_POINT = 0x11
+COMMAND_CAL_APPLY = 0x12
+COMMAND_CAL_RESET = 0x13
+COMMAND_CAL_QUERY = 0x14
+COMMAND_SET_CHAIN = 0x15
+COMMAND_TRACE_START = 0x16
+COMMAND_TRACE_READ = 0x17
+COMMAND_SET_POWER = 0x18
+COMMAND_POWER_QUERY = 0x19
+COMMAND_BOOT_QUERY = 0x1A
+COMMAND_SET_CURRENT = 0x1B
+COMMAND_MODES = ["manual", "balancing", "current"]  # command_mode_t
+BOOT_STAGES = [
+    "safety",
+    "sampling",
+    "measurement",
+    "softdevice",
+    "advertising",
+    "storage",
+    "ready",
+]  # boot_stage_t
+BOOT_TIME_NONE = 0xFFFFFFFF
+
+TRACE_EVENT_LENGTH = 8  # trace_event_t, see trace_convert.py
+
+# history lanes in record order, see Firmware/history.h
+HISTORY_LANE_VALUES = 0
+HISTORY_LANE_DEVIATIONS = 1
+HISTORY_LANE_DUTY = 2
+HISTORY_LANE_PACK = 3
+HISTORY_TREND_BIAS = 0x8000  # SUMMARY_TREND_BIAS
+HISTORY_EMPTY = 0xFFFFFFFFFFFFFFFF
+PLOT_CELLS = 8  # lines in the plot
+
+# raw SAADC slots of the default board, BOARD_MUX_STEP_COUNT *
+# BOARD_ADC_CHANNEL_COUNT, see Firmware/adc.h
+ADC_SLOT_COUNT = 16
+STREAM_MASK_BYTES = (ADC_SLOT_COUNT + 7) // 8
+STREAM_HEADER_LENGTH = 2 + STREAM_MASK_BYTES + 1  # see Firmware/stream.h
+CAPTURE_HEADER_LENGTH = 5  # see Firmware/capture.h
+CAPTURE_ROWS = 512
+
 
 class MainWindow(tk.Tk):
 
-    def __init__(self, event_loop, device_name):
+    def __init__(self, event_loop, device_name, arguments=()):
         super().__init__()
         scaling = 1
         self.title("8-Cell Balancer")
@@ -31,6 +92,19 @@ class MainWindow(tk.Tk):
         self.is_values_ready = False
         self.is_deviations_ready = False
         self.counter_seconds = 0
+        self.command_sequence = 0
+        self.history_layout = None
+        self.trace_events = b""
+        # --stream subscribes to raw samples, --capture=trigger,slot,level,pre
+        # arms a capture that is downloaded once it completes
+        self.is_streaming = "--stream" in arguments
+        self.capture_arm = None
+        for argument in arguments:
+            if argument.startswith("--capture="):
+                self.capture_arm = [int(i) for i in argument[10:].split(",")]
+        self.stream_sequence = None
+        self.stream_file = None
+        self.capture_rows = []
         self.device = None
         self.file = None
         self.protocol("WM_DELETE_WINDOW", self.close)
@@ -162,8 +236,8 @@ class MainWindow(tk.Tk):
                 self.rbt_12h_pressed = True
 
     def values_callback(self, sender, data):
-        values = struct.unpack(f"< {len(data)//2}h", data)
-        print(str(values)[1:-1])
+        timestamp, *values = struct.unpack("< Q 16h", data)
+        print(f"{timestamp}: " + str(values)[1:-1])
 
         for i in range(8):
             self.values["voltage_2min"][i].pop(0)
@@ -173,9 +247,108 @@ class MainWindow(tk.Tk):
         self.is_values_ready = True
         # self.canvas.draw()
 
+    def pack_callback(self, sender, data):
+        # boards of a daisy chain as one pack, voltage and current per cell
+        timestamp, boards, faults, lowest = struct.unpack_from("< Q B B H", data)
+        values = struct.unpack_from(f"< {(len(data) - 12) // 2}H", data, 12)
+        print(
+            f"{timestamp}: pack of {boards} boards, lowest {lowest} mV, "
+            f"faults {faults:#04b}: " + str(values)[1:-1]
+        )
+
+    def summary_callback(self, sender, data):
+        # pack level facts of this board, see Firmware/summary.h
+        (
+            timestamp,
+            total,
+            lowest,
+            highest,
+            spread,
+            trend,
+            lowest_cell,
+            highest_cell,
+            is_balancing,
+        ) = struct.unpack("< Q I H H H h B B B x", data)
+        print(
+            f"{timestamp}: pack {total} mV, cell {lowest_cell + 1} lowest "
+            f"{lowest} mV, cell {highest_cell + 1} highest {highest} mV, "
+            f"spread {spread} mV ({trend:+} mV/h)"
+            + (", balancing" if is_balancing else "")
+        )
+
+    def trace_callback(self, sender, data):
+        # offset, events in the trace, event count, then the events
+        position, total, count = struct.unpack_from("< H H B", data)
+        if position == 0:
+            self.trace_events = b""
+        # --stream subscribes to raw samples, --capture=trigger,slot,level,pre
+        # arms a capture that is downloaded once it completes
+        self.is_streaming = "--stream" in arguments
+        self.capture_arm = None
+        for argument in arguments:
+            if argument.startswith("--capture="):
+                self.capture_arm = [int(i) for i in argument[10:].split(",")]
+        self.stream_sequence = None
+        self.stream_file = None
+        self.capture_rows = []
+        self.trace_events += data[5 : 5 + count * TRACE_EVENT_LENGTH]
+        if position + count == total:
+            with open("trace.bin", "wb") as file:
+                file.write(self.trace_events)
+            print(f"trace of {total} events written to trace.bin")
+
+    def stream_callback(self, sender, data):
+        # sequence, slot mask, row count, then 12 bit samples of the selected
+        # slots, two samples in three bytes
+        (sequence,) = struct.unpack_from("< H", data)
+        mask = int.from_bytes(data[2 : 2 + STREAM_MASK_BYTES], "little")
+        rows = data[STREAM_HEADER_LENGTH - 1]
+        slots = [slot for slot in range(ADC_SLOT_COUNT) if mask & (1 << slot)]
+        if self.stream_sequence is not None:
+            gap = (sequence - self.stream_sequence - 1) % 65536
+            if gap:
+                print(f"stream: {gap} packets dropped")
+        self.stream_sequence = sequence
+
+        payload = data[STREAM_HEADER_LENGTH:]
+        samples = []
+        for n in range(rows * len(slots)):
+            base = (n // 2) * 3
+            if n % 2 == 0:
+                samples.append(payload[base] | (payload[base + 1] & 0x0F) << 8)
+            else:
+                samples.append(payload[base + 1] >> 4 | payload[base + 2] << 4)
+
+        if self.stream_file is None:
+            self.stream_file = open("stream.csv", "w")
+            self.stream_file.write(",".join(f"slot {i}" for i in slots) + "\n")
+        for row in range(rows):
+            values = samples[row * len(slots) : (row + 1) * len(slots)]
+            self.stream_file.write(",".join(str(v) for v in values) + "\n")
+
+    def capture_callback(self, sender, data):
+        # offset, trigger row, row count, then int16 samples of every slot
+        position, trigger, rows = struct.unpack_from("< H H B", data)
+        if position == 0:
+            self.capture_rows = []
+        self.capture_rows += struct.iter_unpack(
+            f"< {ADC_SLOT_COUNT}h", data[CAPTURE_HEADER_LENGTH:]
+        )
+        if position + rows == CAPTURE_ROWS:
+            with open("capture.csv", "w") as file:
+                file.write(
+                    "row,"
+                    + ",".join(f"slot {i}" for i in range(ADC_SLOT_COUNT))
+                    + "\n"
+                )
+                for row, values in enumerate(self.capture_rows):
+                    # rows count from the trigger row
+                    file.write(f"{row - trigger}," + ",".join(map(str, values)) + "\n")
+            print(f"capture of {len(self.capture_rows)} rows written to capture.csv")
+
     def deviations_callback(self, sender, data):
-        string = data.decode()
-        print("dev: " + string)
+        timestamp, *values = struct.unpack("< Q 16h", data)
+        print(f"{timestamp}: dev: " + str(values)[1:-1])
         # string_split = string.split(',')
         # # self.file.write(f"{string}\n")
         # # self.lbl_text.config(text=string)
@@ -196,29 +369,109 @@ class MainWindow(tk.Tk):
             type = "undefined"
         print(f"callback is type: {type}")
 
-        values_packed = struct.unpack(f"< {len(data)//2}h", data)
-
-        for i in range(len(values_packed) // 16):
-            values = values_packed[16 * i : 16 * i + 16]
-
-            if 0 < values[0]:
-                for k in range(8):
+        # records: timestamp in ms + uint16 lanes as advertised by the layout
+        record_length, lanes, cells = self.history_layout
+        count = (record_length - 8) // 2
+        for timestamp, *record in struct.iter_unpack(f"< Q {count}H", data):
+            if timestamp == HISTORY_EMPTY:
+                continue
+            values = {
+                lane: record[offset : offset + width]
+                for lane, (offset, width) in lanes.items()
+            }
+
+            if HISTORY_LANE_VALUES in values:
+                # voltage 1, current 1, voltage 2, ...
+                lane = values[HISTORY_LANE_VALUES]
+                for k in range(min(cells, PLOT_CELLS)):
                     self.values[f"voltage_{type}"][k].pop(0)
                     self.values[f"current_{type}"][k].pop(0)
-                    self.values[f"voltage_{type}"][k].append(
-                        float(values[2 * k]) / 1000
-                    )
-                    self.values[f"current_{type}"][k].append(
-                        float(values[(2 * k) + 1]) / 1000
-                    )
-
-            # print(f"{i}: {values}")
+                    self.values[f"voltage_{type}"][k].append(lane[2 * k] / 1000)
+                    self.values[f"current_{type}"][k].append(lane[2 * k + 1] / 1000)
+            if HISTORY_LANE_DEVIATIONS in values:
+                print(f"{timestamp}: dev: {list(values[HISTORY_LANE_DEVIATIONS])}")
+            if HISTORY_LANE_DUTY in values:
+                print(f"{timestamp}: duty: {list(values[HISTORY_LANE_DUTY])}")
+            if HISTORY_LANE_PACK in values:
+                total, spread, lowest, trend = values[HISTORY_LANE_PACK]
+                print(
+                    f"{timestamp}: pack {total} mV, lowest {lowest} mV, "
+                    f"spread {spread} mV ({trend - HISTORY_TREND_BIAS:+} mV/h)"
+                )
+
+    def command_callback(self, sender, data):
+        # sequence number, then (opcode, status, length, payload) per command
+        sequence = data[0]
+        position = 1
+        while position + 3 <= len(data):
+            opcode, status, length = data[position : position + 3]
+            payload = data[position + 3 : position + 3 + length]
+            position += 3 + length
+            print(f"command {sequence}: opcode {opcode:#04x} status {status}")
+            if opcode == COMMAND_QUERY and status == 0:
+                mode, target, *duty = struct.unpack("< B H 8B", payload)
+                print(f"mode {COMMAND_MODES[mode]}, target {target} mV, duty {duty}")
+            if opcode == COMMAND_FAULT_QUERY and status == 0:
+                fault, cells = payload
+                print(f"fault {fault}, cells {cells:#04x}")
+            if opcode == COMMAND_POWER_QUERY and status == 0:
+                mode, sleep, current, rate = struct.unpack("< B H H H", payload)
+                print(
+                    f"{'monitor' if mode else 'full'} rate, {rate} blocks/s, "
+                    f"sleeping {sleep / 10:.1f}%, about {current} uA"
+                )
+            if opcode == COMMAND_BOOT_QUERY and status == 0:
+                times = struct.unpack(f"< {len(BOOT_STAGES)}I", payload)
+                for stage, time in zip(BOOT_STAGES, times):
+                    text = "-" if time == BOOT_TIME_NONE else f"{time / 1000:.3f} ms"
+                    print(f"boot {stage}: {text}")
+            if opcode == COMMAND_CAPTURE_ARM:
+                print("capture armed" if status == 0 else "capture not armed")
+            if opcode == COMMAND_CAL_QUERY and status == 0:
+                gain, offset, points = struct.unpack("< i i B", payload)
+                print(
+                    f"gain {gain / 65536:.5f}, offset {offset / 65536:.2f}, "
+                    f"points {points:#04b}"
+                )
+
+    async def send_commands(self, commands):
+        # commands: list of (opcode, payload bytes)
+        self.command_sequence = (self.command_sequence + 1) % 256
+        frame = bytes([self.command_sequence])
+        for opcode, payload in commands:
+            frame += bytes([opcode, len(payload)]) + payload
+        await self.client.write_gatt_char(uuids["command"], frame)
+
+    def parse_history_layout(self, layout):
+        record_length, records, lane_count = layout[0:3]
+        lanes = {}
+        offset = 0
+        for i in range(lane_count):
+            lane, width = layout[3 + 2 * i : 5 + 2 * i]
+            lanes[lane] = (offset, width)
+            offset += width
+        # every per cell lane has the cell count in its width
+        if HISTORY_LANE_VALUES in lanes:
+            cells = lanes[HISTORY_LANE_VALUES][1] // 2
+        elif HISTORY_LANE_DEVIATIONS in lanes:
+            cells = lanes[HISTORY_LANE_DEVIATIONS][1] // 2
+        elif HISTORY_LANE_DUTY in lanes:
+            cells = lanes[HISTORY_LANE_DUTY][1]
+        else:
+            cells = 0
+        print(
+            f"history: {records} records of {record_length} bytes, "
+            f"{cells} cells, {lanes}"
+        )
+        return record_length, lanes, cells
 
     async def run_buttons(self):
         if self.btn_pwm_pressed:
             self.btn_pwm_pressed = False
-            val = self.etr_pwm.get()
-            await self.client.write_gatt_char(uuids["pwm_set"], val.encode())
+            duty = bytes(int(i) for i in self.etr_pwm.get().split(","))
+            await self.send_commands(
+                [(COMMAND_SET_DUTY, bytes([0xFF]) + duty), (COMMAND_QUERY, b"")]
+            )
 
         if self.rbt_2min_pressed:
             self.rbt_2min_pressed = False
@@ -263,6 +516,8 @@ class MainWindow(tk.Tk):
         if self.file:
             print("force close file")
             self.file.close()
+        if self.stream_file:
+            self.stream_file.close()
 
         print("stopping loop")
         self.event_loop.stop()
@@ -273,10 +528,34 @@ class MainWindow(tk.Tk):
         self.client = BleakClient(self.device)
         try:
             await self.client.connect()
+            unix_time = struct.pack("< Q", int(time.time() * 1000))
+            await self.client.write_gatt_char(uuids["time"], unix_time)
+            layout = await self.client.read_gatt_char(uuids["history_layout"])
+            self.history_layout = self.parse_history_layout(layout)
             while not self.app_exit_flag:
                 self.lbl_text.config(text="connected")
                 self.btn_pwm_set.config(state="normal")
                 await self.client.start_notify(uuids["values"], self.values_callback)
+                await self.client.start_notify(
+                    uuids["command"], self.command_callback
+                )
+                await self.client.start_notify(uuids["pack"], self.pack_callback)
+                await self.client.start_notify(uuids["trace"], self.trace_callback)
+                await self.client.start_notify(
+                    uuids["summary"], self.summary_callback
+                )
+                await self.client.start_notify(
+                    uuids["capture"], self.capture_callback
+                )
+                if self.is_streaming:
+                    await self.client.start_notify(
+                        uuids["stream"], self.stream_callback
+                    )
+                if self.capture_arm:
+                    trigger, slot, level, pre = self.capture_arm
+                    self.capture_arm = None
+                    payload = struct.pack("< B B h H", trigger, slot, level, pre)
+                    await self.send_commands([(COMMAND_CAPTURE_ARM, payload)])
                 await self.application_loop()
         except Exception as e:
             print(f"Terminating with Exception {e}")
@@ -304,6 +583,6 @@ class MainWindow(tk.Tk):
 # Main function, executed when file is invoked directly.
 if __name__ == "__main__":
     event_loop = asyncio.get_event_loop()
-    MainWindow(event_loop, "8-Cell Balancer")
+    MainWindow(event_loop, "8-Cell Balancer", sys.argv[1:])
     event_loop.run_forever()
     event_loop.close()
@@ -5,5 +5,15 @@ uuids = {
     "deviations" :  str(base_uuid[:4] + "ab02" + base_uuid[8:]),
     "history_1h" :  str(base_uuid[:4] + "ab03" + base_uuid[8:]),
     "history_12h" : str(base_uuid[:4] + "ab04" + base_uuid[8:]),
-    "pwm_set" :     str(base_uuid[:4] + "ab05" + base_uuid[8:])
+    "command" :     str(base_uuid[:4] + "ab05" + base_uuid[8:]),
+    "time" :        str(base_uuid[:4] + "ab06" + base_uuid[8:]),
+    "history_layout" : str(base_uuid[:4] + "ab07" + base_uuid[8:]),
+    "batch" :       str(base_uuid[:4] + "ab08" + base_uuid[8:]),
+    "changes" :     str(base_uuid[:4] + "ab09" + base_uuid[8:]),
+    "stream" :      str(base_uuid[:4] + "ab0a" + base_uuid[8:]),
+    "capture" :     str(base_uuid[:4] + "ab0b" + base_uuid[8:]),
+    "pack" :        str(base_uuid[:4] + "ab0c" + base_uuid[8:]),
+    "trace" :       str(base_uuid[:4] + "ab0d" + base_uuid[8:]),
+    "config" :      str(base_uuid[:4] + "ab0e" + base_uuid[8:]),
+    "summary" :     str(base_uuid[:4] + "ab0f" + base_uuid[8:])
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+import asyncio
+import struct
+import sys
+
+from bleak import BleakClient, BleakScanner
+
+from UUIDs import uuids
+
+# reads and writes the persistent configuration (Firmware/config.h)
+# usage: config_tool.py [field=value ...]
+# without arguments the current record is printed, otherwise the changed
+# record is written, the balancer validates and stores it or keeps the old one
+
+DEVICE_NAME = "8-Cell Balancer"
+CONFIG_VERSION = 1
+SCHEDULE_TASKS = ["control", "report", "history", "chain"]  # schedule_task_t
+FIELDS = [
+    "version",
+    "length",
+    "term_voltage",
+    "term_hysteresis",
+    "term_range",
+    "duty_limit",
+    "voltage_limit",
+    "current_limit",
+    *[f"period_{task}" for task in SCHEDULE_TASKS],
+    "history_1h_interval",
+    "history_12h_interval",
+    "power_policy",
+    "power_interval",
+    "advertising_interval",
+    "advertising_duration",
+    "crc",
+]
+CONFIG_FORMAT = f"< {len(FIELDS)}H"  # config_t
+
+
+def crc16(data):
+    # crc16_compute() of the nRF5 SDK, CCITT polynomial starting at 0xffff
+    crc = 0xFFFF
+    for byte in data:
+        crc = ((crc >> 8) | (crc << 8)) & 0xFFFF
+        crc ^= byte
+        crc ^= (crc & 0xFF) >> 4
+        crc ^= (crc << 12) & 0xFFFF
+        crc ^= ((crc & 0xFF) << 5) & 0xFFFF
+    return crc
+
+
+def decode(data):
+    return dict(zip(FIELDS, struct.unpack(CONFIG_FORMAT, data)))
+
+
+def encode(config):
+    config["version"] = CONFIG_VERSION
+    config["length"] = struct.calcsize(CONFIG_FORMAT)
+    data = struct.pack(CONFIG_FORMAT, *(config[field] for field in FIELDS))
+    config["crc"] = crc16(data[:-2])
+    return data[:-2] + struct.pack("< H", config["crc"])
+
+
+async def main(changes):
+    device = await BleakScanner.find_device_by_name(DEVICE_NAME, 10)
+    if device is None:
+        print("device not found")
+        return
+    async with BleakClient(device) as client:
+        config = decode(await client.read_gatt_char(uuids["config"]))
+        if changes:
+            for change in changes:
+                field, value = change.split("=")
+                if field not in FIELDS[2:-1]:
+                    print(f"unknown field {field}")
+                    return
+                config[field] = int(value, 0)
+            await client.write_gatt_char(uuids["config"], encode(config), True)
+            stored = decode(await client.read_gatt_char(uuids["config"]))
+            print("committed" if stored == config else "rejected")
+            config = stored
+        for field in FIELDS:
+            print(f"{field}: {config[field]}")
+
+
+if __name__ == "__main__":
+    asyncio.run(main(sys.argv[1:]))
@@ -0,0 +1,101 @@
+import csv
+import random
+import sys
+
+# replays SAADC blocks through the firmware filter (filter.c) and the boxcar
+# report average (data.c) to compare noise and lag
+# input: csv with one block per row, columns "average" and "range" in mV
+# without input a cell with sample noise and a step is simulated, seeded so
+# runs repeat, the process noise trades noise for lag
+# usage: filter_replay.py [csv or - to simulate] [process noise, uV per block]
+
+BLOCK_SAMPLES = 8
+REPORT_BLOCKS = 1000  # blocks per report at the default 1 s period
+RANGE_SIGMAS = 3.0
+MEASUREMENT_NOISE_MIN = 1.0
+PROCESS_NOISE = 20  # uV per block, FILTER_PROCESS_NOISE_DEFAULT
+SEED = 1
+
+STEP_BLOCK = 5000
+STEP_HEIGHT = 20.0
+
+
+def simulate_blocks(count=10000, voltage=3300.0, noise=2.0, seed=SEED):
+    rng = random.Random(seed)
+    blocks = []
+    for block in range(count):
+        level = voltage + (STEP_HEIGHT if block >= STEP_BLOCK else 0.0)
+        samples = [round(rng.gauss(level, noise)) for _ in range(BLOCK_SAMPLES)]
+        blocks.append((sum(samples) / BLOCK_SAMPLES, max(samples) - min(samples)))
+    return blocks
+
+
+def read_blocks(path):
+    with open(path, newline="") as file:
+        rows = csv.DictReader(file)
+        return [(float(row["average"]), float(row["range"])) for row in rows]
+
+
+def kalman(blocks, process_noise=PROCESS_NOISE):
+    q = (process_noise / 1000.0) ** 2
+    estimate, variance = None, None
+    output = []
+    for average, spread in blocks:
+        r = max((spread / RANGE_SIGMAS) ** 2 / BLOCK_SAMPLES, MEASUREMENT_NOISE_MIN)
+        if estimate is None:
+            estimate, variance = average, r
+        else:
+            variance += q
+            gain = variance / (variance + r)
+            estimate += gain * (average - estimate)
+            variance *= 1.0 - gain
+        output.append(estimate)
+    return output
+
+
+def boxcar(blocks, length=REPORT_BLOCKS):
+    # reported value is held until the next report
+    output = []
+    reported = blocks[0][0]
+    window = []
+    for average, _ in blocks:
+        window.append(average)
+        if len(window) == length:
+            reported = sum(window) / length
+            window = []
+        output.append(reported)
+    return output
+
+
+def noise(values):
+    mean = sum(values) / len(values)
+    return (sum((v - mean) ** 2 for v in values) / len(values)) ** 0.5
+
+
+def lag(values, start, target):
+    for block in range(start, len(values)):
+        if values[block] >= target:
+            return block - start
+    return None
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 and sys.argv[1] != "-" else None
+    blocks = read_blocks(path) if path else simulate_blocks()
+    process_noise = int(sys.argv[2]) if len(sys.argv) > 2 else PROCESS_NOISE
+    flat = slice(REPORT_BLOCKS, min(STEP_BLOCK, len(blocks)))
+    before = sum(b[0] for b in blocks[flat]) / len(blocks[flat])
+    target = before + 0.9 * STEP_HEIGHT
+
+    for name, output in (
+        ("boxcar", boxcar(blocks)),
+        ("kalman", kalman(blocks, process_noise)),
+    ):
+        print(
+            f"{name}: noise {noise(output[flat]):.3f} mV, "
+            f"90% step lag {lag(output, STEP_BLOCK, target)} blocks"
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+import re
+import struct
+import sys
+
+# decodes the binary log backend (log_binary.c) back into NRF_LOG text, format
+# strings, module names and constant %s arguments are read from the ELF
+# the firmware has to be built with make LOG_BINARY=1
+# usage: log_decode.py <firmware .out> [capture file, default stdin]
+# e.g. a raw serial capture of the log UART at 2576384 baud
+
+SYNC = 0xA5
+HEADER_FORMAT = "< B B H I"  # sync, kind, length, module name address
+HEADER_LENGTH = struct.calcsize(HEADER_FORMAT)
+MAX_PAYLOAD = 4 * (1 + 6)  # format address and NRF_LOG_MAX_NUM_OF_ARGS
+TYPE_STD = 1
+TYPE_HEXDUMP = 2
+SEVERITIES = {1: "error", 2: "warning", 3: "info", 4: "debug"}
+SEVERITY_RAW = 5  # NRF_LOG_SEVERITY_INFO_RAW, printed without prefix
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+SPECIFIER = re.compile(r"%([-+ 0#]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z)?([diuxXcsp%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as file:
+            self.data = file.read()
+        shoff = struct.unpack_from("< I", self.data, 0x20)[0]
+        shentsize, shnum = struct.unpack_from("< H H", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, kind, flags, addr, offset, size = struct.unpack_from(
+                "< 6I", self.data, shoff + i * shentsize
+            )
+            if flags & SHF_ALLOC and kind != SHT_NOBITS:
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b"\0", start)
+                return self.data[start:end].decode("ascii", errors="replace")
+        return f"<{address:#010x}>"  # RAM strings are not in the ELF
+
+
+def format_message(elf, fmt, args):
+    args = list(args)
+
+    def replace(match):
+        flags, width, precision, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        spec = "%" + flags + width + (f".{precision}" if precision else "")
+        if conversion in "di":
+            return (spec + "d") % struct.unpack("< i", struct.pack("< I", value))[0]
+        if conversion == "u":
+            return (spec + "d") % value
+        if conversion == "s":
+            return (spec + "s") % elf.string(value)
+        if conversion == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conversion == "p":
+            return f"{value:#010x}"
+        return (spec + conversion) % value
+
+    return SPECIFIER.sub(replace, fmt)
+
+
+def decode(elf, stream, output):
+    buffer = b""
+    while True:
+        data = stream.read(256)
+        if not data:
+            return
+        buffer += data
+        while len(buffer) >= HEADER_LENGTH:
+            sync, kind, length, module = struct.unpack_from(HEADER_FORMAT, buffer)
+            kind_type, severity = kind >> 4, kind & 0x0F
+            if sync != SYNC or kind_type not in (TYPE_STD, TYPE_HEXDUMP) or (
+                length > MAX_PAYLOAD
+            ):
+                buffer = buffer[1:]  # resynchronize on the next sync byte
+                continue
+            if len(buffer) < HEADER_LENGTH + length:
+                break
+            payload = buffer[HEADER_LENGTH : HEADER_LENGTH + length]
+            buffer = buffer[HEADER_LENGTH + length :]
+
+            if kind_type == TYPE_STD:
+                fmt, *args = struct.unpack(f"< {length // 4}I", payload)
+                text = format_message(elf, elf.string(fmt), args)
+            else:
+                text = " ".join(f"{byte:02x}" for byte in payload)
+                text += "\n" if severity == SEVERITY_RAW else ""
+            if severity == SEVERITY_RAW:
+                output.write(text)
+            else:
+                name = SEVERITIES.get(severity, str(severity))
+                output.write(f"<{name}> {elf.string(module)}: {text}\n")
+            output.flush()
+
+
+def main():
+    elf = Elf(sys.argv[1])
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "rb") as stream:
+            decode(elf, stream, sys.stdout)
+    else:
+        decode(elf, sys.stdin.buffer, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
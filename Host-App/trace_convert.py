@@ -0,0 +1,143 @@
+import json
+import struct
+import sys
+
+# converts a firmware trace (trace.c) to Chrome trace json for chrome://tracing
+# or ui.perfetto.dev
+# input: trace.bin written by Host-App from the trace characteristic, or a log
+# capture of the UART dump (COMMAND_TRACE_READ with target 1), passed through
+# log_decode.py first when the binary log backend is enabled
+# usage: trace_convert.py <trace.bin|log.txt> [trace.json]
+
+EVENT_FORMAT = "< I B x H"  # trace_event_t
+EVENT_LENGTH = struct.calcsize(EVENT_FORMAT)
+TICKS_PER_SECOND = 1000000  # TIMER3 while recording
+TICKS_WRAP = 1 << 32
+
+# trace_event_id_t: name, phase, track, "B"/"E" pair up, "i" is an instant
+EVENTS = [
+    ("saadc block", "B", "saadc"),
+    ("saadc block", "E", "saadc"),
+    ("saadc limit", "i", "saadc"),
+    ("ble event", "B", "softdevice"),
+    ("ble event", "E", "softdevice"),
+    ("task", "B", "schedule"),
+    ("task", "E", "schedule"),
+    ("pwm update", "i", "control"),
+    ("command", "i", "control"),
+    ("chain frame", "i", "chain"),
+    ("fault", "i", "control"),
+    ("idle", "B", "main"),
+    ("idle", "E", "main"),
+    ("boot stage", "i", "main"),
+]
+TASKS = ["control", "report", "history", "chain"]  # schedule_task_t
+BLE_EVENTS = {
+    0x10: "connected",
+    0x11: "disconnected",
+    0x12: "conn param update",
+    0x21: "phy update request",
+    0x22: "phy update",
+    0x23: "data length update request",
+    0x24: "data length update",
+    0x50: "gatts write",
+    0x52: "sys attr missing",
+    0x55: "exchange mtu request",
+    0x57: "hvn tx complete",
+}
+BOOT_STAGES = [
+    "safety",
+    "sampling",
+    "measurement",
+    "softdevice",
+    "advertising",
+    "storage",
+    "ready",
+]  # boot_stage_t
+TRACKS = ["saadc", "softdevice", "schedule", "control", "chain", "main"]
+
+
+def read_binary(data):
+    count = len(data) // EVENT_LENGTH
+    return [
+        struct.unpack_from(EVENT_FORMAT, data, i * EVENT_LENGTH) for i in range(count)
+    ]
+
+
+def read_log(text):
+    # NRF_LOG_RAW_HEXDUMP_INFO lines between "trace <n> events" and "trace end"
+    data = bytearray()
+    is_dump = False
+    for line in text.splitlines():
+        if line.startswith("trace ") and line.endswith(" events"):
+            data, is_dump = bytearray(), True
+        elif line.startswith("trace end"):
+            is_dump = False
+        elif is_dump:
+            data += bytes(int(token, 16) for token in line.split("|")[0].split())
+    return read_binary(data)
+
+
+def event_name(name, arg):
+    if name == "task":
+        return TASKS[arg] if arg < len(TASKS) else f"task {arg}"
+    if name == "ble event":
+        return BLE_EVENTS.get(arg, f"ble {arg:#04x}")
+    if name == "boot stage":
+        return f"boot {BOOT_STAGES[arg]}" if arg < len(BOOT_STAGES) else name
+    return name
+
+
+def convert(events):
+    trace = []
+    offset, last = 0, None
+    for ticks, event_id, arg in events:
+        # the timer wraps every 71 min, events are far more frequent, an
+        # event preempted between claiming its slot and reading the timer
+        # only steps back a little
+        if last is not None and last - ticks > TICKS_WRAP // 2:
+            offset += TICKS_WRAP
+        last = ticks
+        if event_id >= len(EVENTS):
+            continue
+        name, phase, track = EVENTS[event_id]
+        entry = {
+            "name": event_name(name, arg),
+            "ph": phase,
+            "ts": (ticks + offset) * 1000000 / TICKS_PER_SECOND,
+            "pid": 1,
+            "tid": TRACKS.index(track),
+            "args": {"arg": arg},
+        }
+        if phase == "i":
+            entry["s"] = "t"
+        trace.append(entry)
+
+    for tid, track in enumerate(TRACKS):
+        trace.append(
+            {
+                "name": "thread_name",
+                "ph": "M",
+                "pid": 1,
+                "tid": tid,
+                "args": {"name": track},
+            }
+        )
+    return {"traceEvents": trace, "displayTimeUnit": "ns"}
+
+
+def main():
+    with open(sys.argv[1], "rb") as file:
+        data = file.read()
+    if b"trace end" in data:
+        events = read_log(data.decode("ascii", errors="ignore"))
+    else:
+        events = read_binary(data)
+    output = sys.argv[2] if len(sys.argv) > 2 else "trace.json"
+    with open(output, "w") as file:
+        json.dump(convert(events), file)
+    print(f"{len(events)} events written to {output}")
+
+
+if __name__ == "__main__":
+    main()